@@ -18,12 +18,65 @@
 #ifndef AVLTree_h
 #define AVLTree_h
 
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <functional>
+#include <map>
+#include <climits>
+#include <type_traits>
+#include "AVLTreeStats.h"
+#include "AVLTreeTrace.h"
+#include "AVLTreeBalance.h"
+#include "AVLTreeHash.h"
+#include "AVLTreeMemory.h"
+
 namespace mathsophy
 {
 
-template<class T>
+template<class T, class P = AVLBalance>
 class AVLTree;
 
+template<class T>
+class AVLFinger;
+
+template<class T>
+class FrozenAVLTree;
+
+template<class T>
+class EytzingerIndex;
+
+// Keys carrying a summary of their subtree, e.g. the largest endpoint of the
+// intervals of an interval tree, provide augment(left, right) to compute it
+// again from the keys of the children, nullptr standing for a missing child.
+// The summary is updated wherever the sizes of the subtrees are.
+template<class T, class = void>
+struct is_augmented : std::false_type { };
+
+template<class T>
+struct is_augmented<T, std::void_t<decltype(std::declval<T&>().augment(nullptr, nullptr))>> : std::true_type { };
+
+// Comparison of the searched key with the keys met by the descents of the
+// insertions and removals. compare returns a positive value if the searched
+// key is greater than the key of the node, a negative one if it is smaller
+// and 0 if they are equal. The object lives for one descent and sees the
+// keys of the path in order, so a specialization may keep state along the
+// path, e.g. the prefix already known to match for string keys.
+template<class T>
+class AVLKeySearch
+{
+public:
+    // constructor
+    explicit AVLKeySearch(const T& k) : key(k) { };
+    // order of the searched key with respect to the key of the next node
+    int         compare(const T& current) const { return (key > current) ? 1 : ((key < current) ? -1 : 0); };
+private:
+    const T&    key;
+};
+
 template<class T>
 class AVLNode
 {
@@ -43,7 +96,7 @@ public:
     AVLNode<T>* get_right() const           { return right; };
     void        set_right(AVLNode<T>* node) { right=node; };
     // friend
-    friend class AVLTree<T>;
+    template<class, class> friend class AVLTree;
 private:
     T       key;
     int     height;
@@ -52,67 +105,401 @@ private:
     AVLNode *right;
 };
 
+// optional fields of the nodes, empty unless selected by the policy
+template<bool>
+struct AVLNodeCount { };
+
+template<>
+struct AVLNodeCount<true> { std::size_t count = 1; };
+
+template<bool>
+struct AVLNodeSize { };
+
+template<>
+struct AVLNodeSize<true> { std::size_t size = 1; };
+
+template<bool>
+struct AVLNodeMark { };
+
+template<>
+struct AVLNodeMark<true> { bool dirty = false; };
+
+template<bool>
+struct AVLNodeReference { };
+
+template<>
+struct AVLNodeReference<true> { bool referenced = false; };
+
+// Node allocated by a tree, the AVLNode followed by the optional fields of
+// the features F of the policy (see AVLTreeBalance.h). The fields of the
+// features not selected are empty bases taking no room, so a tree without
+// features has nodes of the size of an AVLNode. The trees hand out pointers
+// to the AVLNode and reach the optional fields by a static cast.
+template<class T, unsigned int F>
+class AVLFeatureNode : public AVLNode<T>,
+                       AVLNodeCount<(F & node_counts) != 0>,
+                       AVLNodeSize<(F & node_sizes) != 0>,
+                       AVLNodeMark<(F & node_marks) != 0>,
+                       AVLNodeReference<(F & node_references) != 0>
+{
+public:
+    // constructor
+    explicit AVLFeatureNode(T k) : AVLNode<T>(k) { };
+    // friend
+    template<class, class> friend class AVLTree;
+};
+
+// position in a tree, kept as the path from the root to the node together
+// with, for each level of the path, the level of the nearest ancestor having
+// the node in its left subtree and in its right subtree. These ancestors bound
+// the keys of the subtree of the node, so that an insertion close to the last
+// one can start from the deepest subtree covering the new key.
 template<class T>
+class AVLFinger
+{
+public:
+    // constructor
+    AVLFinger() : tree(nullptr), modifications(0) { };
+    // node of the last hinted insertion
+    AVLNode<T>* get_node() const { return path.empty() ? nullptr : path.back(); };
+    // forget the position, the next hinted insertion starts from the root
+    void        clear() { path.clear(); left_turn.clear(); right_turn.clear(); };
+    // friend
+    template<class, class> friend class AVLTree;
+private:
+    void        push(AVLNode<T>* node);
+    void        truncate(std::size_t size);
+    std::vector<AVLNode<T>*> path;
+    std::vector<int>         left_turn;
+    std::vector<int>         right_turn;
+    // tree and modification counter the path is valid for
+    const void*              tree;
+    std::size_t              modifications;
+};
+
+// AVL tree of keys of type T, balanced by the policy P (see AVLTreeBalance.h)
+// whose features select the optional fields of the nodes
+template<class T, class P>
 class AVLTree
 {
+    static_assert(!(P::features & node_counts) || (P::features & node_sizes), "node_counts requires node_sizes");
 public:
     // constructor
-    AVLTree() : root(nullptr) { };
+    AVLTree() : root(nullptr), modifications(0), finger_mode(false), relaxed_mode(false), pending_modifications(0), recorder(nullptr), multiset_mode(false),
+                  lazy_mode(false), compaction_threshold(0.25), tombstones(0), nodes(0), hash_mode(false), cache_mode(false), compacting(false), cursor_valid(false),
+                  memory_bytes(0), peak_bytes(0), memory_limit(0), eviction_policy(evict_smallest), evictions(0), hand_valid(false) { };
     // copy constructor
-    AVLTree(AVLTree<T>& tree) { *this = tree; };
+    AVLTree(AVLTree<T,P>& tree) : root(nullptr), modifications(0), finger_mode(false), relaxed_mode(false), pending_modifications(0), recorder(nullptr), multiset_mode(false),
+                  lazy_mode(false), compaction_threshold(0.25), tombstones(0), nodes(0), hash_mode(false), cache_mode(false), compacting(false), cursor_valid(false),
+                  memory_bytes(0), peak_bytes(0), memory_limit(0), eviction_policy(evict_smallest), evictions(0), hand_valid(false) { *this = tree; };
     // destructor
     virtual ~AVLTree() { clear(); };
     // assignment operator
-    AVLTree<T>& operator=(const AVLTree<T>& tree);
+    AVLTree<T,P>& operator=(const AVLTree<T,P>& tree);
     // getter and setter functions
     AVLNode<T>* get_root() const        { return root; };
     void        set_root(AVLNode<T>* r);
     // balanced insertion of a new element
     void        insert(T key);
+    // balanced insertion of a new element starting from the given position
+    void        insert(AVLFinger<T>& hint, T key);
+    // finger mode: insertions start from the position of the last insertion
+    bool        get_finger_mode() const { return finger_mode; };
+    void        set_finger_mode(bool mode) { finger_mode = mode; finger.clear(); };
     // unbalanced insertion of a new element
     void        unbalanced_insert(T key);
     // find an element
     AVLNode<T>* find(T key);
+    // hash mode: a hash index of the nodes serves find and find_batch in
+    // O(1), the load factor trades the memory of the index for speed
+    bool        get_hash_mode() const { return hash_mode; };
+    bool        set_hash_mode(bool mode, double max_load = 0.5);
+    // bytes taken by the hash index
+    std::size_t hash_memory() const { return index.memory(); };
+    // cache mode: a direct-mapped cache of the nodes found most often serves
+    // find in one probe before the traversal, for skewed lookups. find then
+    // writes to the cache slots and counters, so concurrent lookups need
+    // exclusive access to the tree
+    bool        get_cache_mode() const { return cache_mode; };
+    void        set_cache_mode(bool mode, std::size_t entries = 1024);
+    // lookups served by the cache and lookups missing it since it was set
+    std::uint64_t get_cache_hits() const { return cache.get_hits(); };
+    std::uint64_t get_cache_misses() const { return cache.get_misses(); };
+    // multiset mode: insertions of a present key increment its multiplicity,
+    // removals decrement it and remove the node when it drops to zero, with
+    // node_counts only
+    bool        get_multiset_mode() const { return multiset_mode; };
+    void        set_multiset_mode(bool mode) { static_assert(has_counts, "multiset mode requires node_counts"); multiset_mode = mode; };
+    // multiplicity of an element, 0 if not present
+    std::size_t count(T key) const;
+    // number of elements counted with their multiplicity
+    std::size_t size() const { return has_sizes ? node_size(root) : nodes; };
+    // number of elements smaller than the given key, with node_sizes only
+    std::size_t rank(T key) const;
+    // element at the given position in ascending order, nullptr if none,
+    // with node_sizes only
+    AVLNode<T>* select(std::size_t position) const;
+    // multiplicity of the key of a node, 0 for a tombstone, and number of
+    // elements of its subtree, with node_sizes only
+    static std::size_t get_count(const AVLNode<T>* node);
+    static std::size_t get_size(const AVLNode<T>* node);
+    // find a batch of elements, out receives one node pointer per key
+    void        find_batch(const std::vector<T>& keys, std::vector<AVLNode<T>*>& out);
     // balanced removal of an element
     void        remove(T key);
+    // lazy mode: removals only turn the node of the last occurrence into a
+    // tombstone, the tombstones are purged when they exceed the compaction
+    // threshold as a fraction of the nodes, a threshold of 1 never purges,
+    // with node_counts only
+    bool        get_lazy_mode() const { return lazy_mode; };
+    void        set_lazy_mode(bool mode) { static_assert(has_counts, "lazy mode requires node_counts"); lazy_mode = mode; };
+    double      get_compaction_threshold() const { return compaction_threshold; };
+    void        set_compaction_threshold(double fraction) { compaction_threshold = fraction; };
+    // number of nodes, tombstones included, and number of tombstones
+    std::size_t get_nodes() const { return nodes; };
+    std::size_t get_tombstones() const { return tombstones; };
+    // purge the tombstones, rebuild the tree balanced in O(n) and move its
+    // nodes in key order into one contiguous block
+    void        compact() { rebuild(true); relocate(); };
+    // move the nodes in key order into one contiguous block a few at a time,
+    // within the given time budget, return true when done
+    bool        compact_incremental(std::chrono::nanoseconds budget);
+    bool        is_compaction_pending() const { return compacting; };
     // unbalanced removal of an element
     void        unbalanced_remove(T key);
+    // relaxed mode: insertions and removals are unbalanced, the nodes
+    // to be rebalanced are marked and repaired by rebalance_pending, with
+    // node_marks only
+    bool        get_relaxed_mode() const { return relaxed_mode; };
+    void        set_relaxed_mode(bool mode) { static_assert(has_marks, "relaxed mode requires node_marks"); relaxed_mode = mode; };
+    // incremental rebalancing of the marked nodes, return true when done
+    bool        rebalance_pending(std::size_t budget = SIZE_MAX);
+    bool        is_rebalance_pending() const { return node_marked(root); };
+    // rebuild the whole tree into a perfectly balanced tree in O(n)
+    void        rebalance_all() { rebuild(false); };
+    // replace the elements by the given keys in ascending order, built
+    // balanced in O(n) without searching
+    void        bulk_load(const std::vector<T>& keys);
     // test for balanced tree
     bool        is_balanced() const;
     bool        is_not_balanced() const { return !is_balanced(); };
+    // test of order, heights and balance of every node, optionally splitting
+    // the tree into subtrees checked by the given number of threads
+    bool        validate(unsigned int threads = 1) const;
     // test for empty tree
     bool        is_empty() const { return root == nullptr; };
     bool        is_not_empty() const { return root != nullptr; };
+    // bytes taken by the tree: the nodes and the compaction blocks with their
+    // heap overhead, the heap storage of the keys, the hash index and the
+    // cache, and the highest value since the creation of the tree
+    std::size_t memory_usage() const { return sizeof(*this) + memory_bytes + index.memory() + cache.memory(); };
+    std::size_t peak_memory_usage() const { return peak_bytes; };
+    // bounded mode: after an insertion that takes the memory usage over the
+    // limit, the nodes chosen by the policy are evicted until it is within
+    // the limit again, 0 for no limit. With evict_lru, find marks the nodes
+    // it returns, so concurrent lookups need exclusive access to the tree;
+    // evict_lru needs node_references and is rejected without
+    std::size_t get_memory_limit() const { return memory_limit; };
+    AVLEvictionPolicy get_eviction_policy() const { return eviction_policy; };
+    bool        set_memory_limit(std::size_t bytes, AVLEvictionPolicy policy = evict_smallest);
+    // number of nodes evicted since the creation of the tree
+    std::uint64_t get_evictions() const { return evictions; };
+    // recorder of the insert, remove and find calls, nullptr to stop recording.
+    // find writes to the recorder, so concurrent lookups of a traced tree
+    // need exclusive access to the tree
+    AVLTraceRecorder<T>* get_recorder() const { return recorder; };
+    void        set_recorder(AVLTraceRecorder<T>* r) { recorder = r; };
+    // snapshot of the operation counters, all zero without AVLTREE_STATS
+    AVLTreeStats stats() const;
+    void        reset_stats();
+    // read-only snapshot in van Emde Boas layout
+    FrozenAVLTree<T> freeze() const;
+    // read-only index in Eytzinger layout, for integral keys only
+    EytzingerIndex<T> export_eytzinger() const;
 protected:
+    // node with the optional fields of the features of the policy
+    typedef AVLFeatureNode<T, P::features> Node;
+    static constexpr bool has_sizes      = (P::features & node_sizes) != 0;
+    static constexpr bool has_counts     = (P::features & node_counts) != 0;
+    static constexpr bool has_marks      = (P::features & node_marks) != 0;
+    static constexpr bool has_references = (P::features & node_references) != 0;
+    static Node*       fields(AVLNode<T>* node) { return static_cast<Node*>(node); };
+    static const Node* fields(const AVLNode<T>* node) { return static_cast<const Node*>(node); };
+    // in-place access to the key of a node for derived trees
+    static T&   node_key(AVLNode<T>* node) { return node->key; };
     // private helper functions
     void        clear();
     void        update_height_node(AVLNode<T>* node);
-    AVLNode<T>* new_node(T key) { return new AVLNode<T>(key); };
+    void        update_size_node(AVLNode<T>* node);
+    AVLNode<T>* new_node(T key);
+    void        delete_node(AVLNode<T>* node);
+    void        release_node(AVLNode<T>* node);
+    void        new_arena(std::size_t capacity);
+    AVLNode<T>* move_node(AVLNode<T>* node);
+    void        relocate();
+    void        end_compaction();
+    void        update_peak() { if (memory_usage() > peak_bytes) peak_bytes = memory_usage(); };
+    void        enforce_memory_limit();
+    AVLNode<T>* found_node(AVLNode<T>* node);
+    AVLNode<T>* eviction_victim();
+    AVLNode<T>* next_node(const T& key, bool inclusive) const;
     void        insertnb(T key, std::vector<AVLNode<T>*>& path);
     void        removenb(T key, std::vector<AVLNode<T>*>& path);
+    void        lazy_remove(T key);
     void        cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<AVLNode<T>*>& path);
+    void        splice_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<AVLNode<T>*>& path);
     int         compute_node_balance(AVLNode<T>* node) const;
     void        rebalance(std::vector<AVLNode<T>*>& path);
+    void        rebalance_removal(std::vector<AVLNode<T>*>& path);
+    int         rebalance_insertion(const std::vector<AVLNode<T>*>& path, std::size_t size, std::size_t top = 0);
+    void        mark_path(std::vector<AVLNode<T>*>& path);
+    void        rebuild(bool purge);
+    static std::size_t tree_to_vine(AVLNode<T>* pseudo_root);
+    std::size_t purge_vine(AVLNode<T>* pseudo_root);
+    static void compress_vine(AVLNode<T>* pseudo_root, std::size_t count);
+    void        update_heights();
+    void        repair_node(std::vector<AVLNode<T>*>& path);
+    static int  node_height(const AVLNode<T>* node) { return node ? node->height : 0; };
+    static std::size_t node_size(const AVLNode<T>* node);
+    static bool node_marked(const AVLNode<T>* node);
+    static void copy_fields(AVLNode<T>* copy, const AVLNode<T>* node);
+    void        update_sizes(const std::vector<AVLNode<T>*>& path, std::size_t size, std::size_t top = 0);
+    void        trace(AVLTraceOperation operation, const T& key);
+    bool        validate_subtree(const AVLNode<T>* node, const T* low, const T* high, int split,
+                                 const std::vector<int>& heights, std::size_t& next, int& height) const;
+    std::size_t finger_level(const AVLFinger<T>& hint, T key) const;
     AVLNode<T>* rebalance_to_right(AVLNode<T>* node, AVLNode<T>* parent);
     AVLNode<T>* rebalance_to_left(AVLNode<T>* node, AVLNode<T>* parent);
     AVLNode<T>* rotate_left(AVLNode<T>* node);
     AVLNode<T>* rotate_right(AVLNode<T>* node);
     AVLNode<T>* root;
+    // counter of the structural modifications, a hint is valid only as long as
+    // the tree is not modified by other means than the hinted insertion
+    std::size_t modifications;
+    bool        finger_mode;
+    AVLFinger<T> finger;
+    // relaxed mode and post-order position of the pending rebalancing
+    bool        relaxed_mode;
+    std::vector<AVLNode<T>*> pending;
+    std::size_t pending_modifications;
+    // optional trace of the operations
+    AVLTraceRecorder<T>* recorder;
+    bool        multiset_mode;
+    // lazy removal and counters of the nodes and of the tombstones among them
+    bool        lazy_mode;
+    double      compaction_threshold;
+    std::size_t tombstones;
+    std::size_t nodes;
+    // optional hash index of the nodes
+    bool        hash_mode;
+    AVLHashIndex<T> index;
+    // optional cache of the hot keys
+    bool        cache_mode;
+    AVLHotCache<T> cache;
+    // blocks of nodes filled by the compaction by start address, so that the
+    // block of a node is found in O(log blocks), a block is freed with its
+    // last node
+    struct Arena
+    {
+        Node*       nodes;
+        std::size_t capacity;
+        std::size_t used;
+        std::size_t live;
+    };
+    typedef std::map<const Node*, Arena> Arenas;
+    Arenas      arenas;
+    // block being filled by the compaction
+    typename Arenas::iterator filling;
+    // incremental compaction into the filled block, key of the last moved node
+    bool        compacting;
+    bool        cursor_valid;
+    T           cursor;
+    // bytes of the nodes, keys and blocks, their peak and the optional limit
+    std::size_t memory_bytes;
+    std::size_t peak_bytes;
+    std::size_t memory_limit;
+    AVLEvictionPolicy eviction_policy;
+    std::uint64_t evictions;
+    // key where the CLOCK hand resumes its sweep for evict_lru
+    bool        hand_valid;
+    T           hand;
+#ifdef AVLTREE_STATS
+    // operation counters
+    AVLTreeCounters counters;
+#endif
 };
 
+// append a node to the path
+// precondition: the node is a child of the last node of the path,
+// or the root if the path is empty
+// postcondition: node appended with its nearest turning ancestors
+template <class T>
+void AVLFinger<T>::push(AVLNode<T>* node)
+{
+    int level = static_cast<int>(path.size());
+    
+    if (path.empty())
+    {
+        left_turn.push_back(-1);
+        right_turn.push_back(-1);
+    }
+    else if (path.back()->get_left() == node)
+    {
+        left_turn.push_back(level - 1);
+        right_turn.push_back(right_turn.back());
+    }
+    else
+    {
+        left_turn.push_back(left_turn.back());
+        right_turn.push_back(level - 1);
+    }
+    
+    path.push_back(node);
+}
+
+// shorten the path
+// precondition: size not greater than the path size
+// postcondition: only the first size levels of the path are kept
+template <class T>
+void AVLFinger<T>::truncate(std::size_t size)
+{
+    path.resize(size);
+    left_turn.resize(size);
+    right_turn.resize(size);
+}
+
 // assignement operator
 // precondition: valid tree is given
 // postcondition: input tree is copied to the current tree
-template <class T>
-AVLTree<T>& AVLTree<T>::operator=(const AVLTree<T>& tree)
+template <class T, class P>
+AVLTree<T,P>& AVLTree<T,P>::operator=(const AVLTree<T,P>& tree)
 {
+    if (this == &tree)
+        return *this;
+    
     if (is_not_empty())
         clear();
     
+    modifications++;
+    multiset_mode        = tree.multiset_mode;
+    lazy_mode            = tree.lazy_mode;
+    compaction_threshold = tree.compaction_threshold;
+    tombstones           = tree.tombstones;
+    hash_mode            = tree.hash_mode;
+    index.set_max_load(tree.index.get_max_load());
+    cache_mode           = tree.cache_mode;
+    if constexpr (is_hashable<T>::value)
+        cache.resize(tree.cache.capacity());
+    memory_limit         = tree.memory_limit;
+    eviction_policy      = tree.eviction_policy;
+    
+    if (tree.is_empty())
+        return *this;
+    
     std::vector<AVLNode<T>*> q, qc;
     q.push_back(tree.root);
     
-    this->root = new_node(0);
+    this->root = new_node(tree.root->key);
     qc.push_back(this->root);
     
     // check each node by breadth first traversal
@@ -124,20 +511,20 @@ AVLTree<T>& AVLTree<T>::operator=(const AVLTree<T>& tree)
         q.erase(q.begin());
         qc.erase(qc.begin());
         
-        copy_node->key     = node->key;
         copy_node->height  = node->height;
         copy_node->balance = node->balance;
+        copy_fields(copy_node, node);
         
         if (node->left)
         {
             q.push_back(node->left);
-            copy_node->left = new_node(0);
+            copy_node->left = new_node(node->left->key);
             qc.push_back(copy_node->left);
         }
         if (node->right)
         {
             q.push_back(node->right);
-            copy_node->right = new_node(0);
+            copy_node->right = new_node(node->right->key);
             qc.push_back(copy_node->right);
         }
     }
@@ -148,67 +535,219 @@ AVLTree<T>& AVLTree<T>::operator=(const AVLTree<T>& tree)
 // set the input node as the new root pointer
 // precondition: valid node pointer is given
 // postcondition: root pointer updated
-template <class T>
-void AVLTree<T>::set_root(AVLNode<T>* r)
+template <class T, class P>
+void AVLTree<T,P>::set_root(AVLNode<T>* r)
 {
     if ( is_not_empty() )
         clear();
     root = r;
+    modifications++;
 }
 
 // insert a new key into the tree by keeping the tree balanced
 // precondition: none
 // postcondition: new node with the given key is inserted
 // and the tree is kept balanced, node heights correctly updated
-template <class T>
-void AVLTree<T>::insert(T key)
+template <class T, class P>
+void AVLTree<T,P>::insert(T key)
 {
+    if (finger_mode)
+    {
+        insert(finger, key);
+        return;
+    }
+    
+    if (relaxed_mode)
+    {
+        unbalanced_insert(key);
+        return;
+    }
+    
+    // complete the pending rebalancing first
+    if ( is_rebalance_pending() )
+        (void)rebalance_pending();
+    
     std::vector<AVLNode<T>*> path;
+    std::size_t before = modifications;
     
     // unbalanced insert
     insertnb(key,path);
     
+    // a present key only changes the sizes along the path
+    if (modifications == before)
+        update_sizes(path, path.size());
     // rebalance the tree by rebalancing
     // the traversed nodes during insertion
-    rebalance(path);
+    else
+        (void)rebalance_insertion(path, path.size());
+    
+    enforce_memory_limit();
+}
+
+// insert a new key into the tree starting from a position close to the key,
+// e.g. the position of the previous insertion. The search climbs from the
+// hinted node to the deepest ancestor whose subtree covers the key and goes
+// down from there, so keys inserted in ascending or almost ascending order
+// cost a constant number of comparisons
+// precondition: none, a hint set on another tree or before a modification of
+// the tree by other means is ignored
+// postcondition: new node with the given key is inserted and the tree is kept
+// balanced, the hint is moved to the node of the key
+template <class T, class P>
+void AVLTree<T,P>::insert(AVLFinger<T>& hint, T key)
+{
+    if (relaxed_mode)
+    {
+        hint.clear();
+        unbalanced_insert(key);
+        return;
+    }
+    
+    // complete the pending rebalancing first
+    if ( is_rebalance_pending() )
+        (void)rebalance_pending();
+    
+    trace(trace_insert, key);
+    
+    if ( is_empty() )
+    {
+        root = new_node(key);
+        hint.clear();
+        hint.push(root);
+        hint.tree          = this;
+        hint.modifications = ++modifications;
+        return;
+    }
+    
+    // climb to the deepest subtree covering the key, unless the
+    // tree has been modified since the hint was set
+    if ( hint.path.empty() || hint.tree != this || hint.modifications != modifications )
+    {
+        hint.clear();
+        hint.push(root);
+    }
+    else
+        hint.truncate(finger_level(hint, key) + 1);
+    
+    // descend from there
+    AVLNode<T>* node = hint.path.back();
+    while (true)
+    {
+        AVLNode<T>** link = nullptr;
+        if (key > node->key)
+            link = &node->right;
+        else if (key < node->key)
+            link = &node->left;
+        else
+        // key already present!
+        {
+            // one more occurrence, a tombstone comes back to life
+            if constexpr (has_counts)
+            {
+                if (multiset_mode || fields(node)->count == 0)
+                {
+                    if (fields(node)->count == 0)
+                        tombstones--;
+                    fields(node)->count++;
+                    update_sizes(hint.path, hint.path.size());
+                }
+            }
+            hint.tree          = this;
+            hint.modifications = modifications;
+            return;
+        }
+        
+        if (!*link)
+        {
+            *link = new_node(key);
+            hint.push(*link);
+            hint.tree          = this;
+            hint.modifications = ++modifications;
+            break;
+        }
+        
+        node = *link;
+        hint.push(node);
+    }
+    
+    // rebalance the ancestors of the new node
+    int level = rebalance_insertion(hint.path, hint.path.size() - 1);
+    
+    // the nodes from the rotated level down have moved, find them again
+    if (level >= 0)
+    {
+        hint.truncate(level);
+        node = level ? hint.path.back() : nullptr;
+        node = node ? (key > node->key ? node->right : node->left) : root;
+        while (true)
+        {
+            hint.push(node);
+            if (key > node->key)
+                node = node->right;
+            else if (key < node->key)
+                node = node->left;
+            else
+                break;
+        }
+    }
+    
+    enforce_memory_limit();
 }
 
 // insert a new key into the tree without balancing the tree
 // precondition: none
-// postcondition: new node with the given key is inserted
-template <class T>
-void AVLTree<T>::unbalanced_insert(T key)
+// postcondition: new node with the given key is inserted,
+// node heights correctly updated
+template <class T, class P>
+void AVLTree<T,P>::unbalanced_insert(T key)
 {
     std::vector<AVLNode<T>*> path;
     
+    std::size_t before = modifications;
+    
+    // an insertion keeps the pending rebalancing position valid
+    bool pending_valid = (pending_modifications == modifications);
+    
     // unbalanced insert
     insertnb(key,path);
     
-    AVLNode<T>* node     = nullptr;
-    while (!path.empty())
-    {
-        // get a node from the traversed path
-        node = path.back();
-        path.pop_back();
-        
-        (void)compute_node_balance(node);
-        
-        update_height_node(node);
-    }
+    if (pending_valid)
+        pending_modifications = modifications;
+    
+    // a present key only changes the sizes along the path,
+    // otherwise update heights and mark the unbalanced nodes
+    if (modifications == before)
+        update_sizes(path, path.size());
+    else
+        mark_path(path);
+    
+    enforce_memory_limit();
 }
 
 // find a key in the tree
 // precondition: none
 // postcondition: return the pointer to the node if the key is found,
 // otherwise return a nullptr if the key is not found
-template <class T>
-AVLNode<T>* AVLTree<T>::find(T key)
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::find(T key)
 {
+    trace(trace_find, key);
+    
     if ( is_empty() )
         return nullptr;
     
     AVLNode<T>* node = root;
     
+    // a single probe of the hash index, or of the cache
+    if constexpr (is_hashable<T>::value)
+    {
+        if (hash_mode)
+            return found_node(index.find(key));
+        if (cache_mode)
+            if (AVLNode<T>* cached = cache.find(key))
+                return found_node(cached);
+    }
+    
     // tree traversal
     while (node)
     {
@@ -217,169 +756,1147 @@ AVLNode<T>* AVLTree<T>::find(T key)
         else if (key < node->key)
             node = node->left;
         else
-        // key found!
-            return node;
+        {
+            if constexpr (is_hashable<T>::value)
+                if (cache_mode)
+                    cache.admit(key, node);
+            // key found!
+            return found_node(node);
+        }
     }
     
     return nullptr;
 }
 
-// remove an element from the tree by keeping the tree balanced
+// result of find for the node of the key
 // precondition: none
-// postcondition: node with the given key is removed
-// and the tree is kept balanced, node heights correctly updated
-template <class T>
-void AVLTree<T>::remove(T key)
+// postcondition: return nullptr for a missing key or a tombstone, otherwise
+// return the node, marked as used for the evict_lru policy
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::found_node(AVLNode<T>* node)
 {
-    std::vector<AVLNode<T>*> path;
+    if (!node || get_count(node) == 0)
+        return nullptr;
     
-    // unbalanced remove
-    removenb(key,path);
+    if constexpr (has_references)
+        if (memory_limit && eviction_policy == evict_lru)
+            fields(node)->referenced = true;
     
-    // rebalance the tree by rebalancing
-    // the traversed nodes during removal
-    rebalance(path);
+    return node;
 }
 
-// remove an element from the tree without balancing the tree
+// multiplicity of a key
 // precondition: none
-// postcondition: node with the given key is removed
-// and the tree is kept balanced, node heights correctly updated
-template <class T>
-void AVLTree<T>::unbalanced_remove(T key)
+// postcondition: return the number of occurrences of the key, 0 if the key
+// is not found
+template <class T, class P>
+std::size_t AVLTree<T,P>::count(T key) const
 {
-    std::vector<AVLNode<T>*> path;
-    
-    // unbalanced insert
-    removenb(key,path);
+    const AVLNode<T>* node = root;
     
-    AVLNode<T>* node     = nullptr;
-    while (!path.empty())
+    // tree traversal
+    while (node)
     {
-        // get a node from the traversed path
-        node = path.back();
-        path.pop_back();
-        
-        (void)compute_node_balance(node);
-        
-        update_height_node(node);
+        if (key > node->key)
+            node = node->right;
+        else if (key < node->key)
+            node = node->left;
+        else
+        // key found!
+            return get_count(node);
     }
+    
+    return 0;
 }
 
-
-// check whether the tree is balanced
+// rank of a key among the elements, counted with their multiplicity
 // precondition: none
-// postcondition: returns true if balance is not violated, false otherwise
-template <class T>
-bool AVLTree<T>::is_balanced() const
+// postcondition: return the number of elements smaller than the key
+template <class T, class P>
+std::size_t AVLTree<T,P>::rank(T key) const
 {
-    if ( is_empty() )
-        return true;
+    static_assert(has_sizes, "rank requires node_sizes");
     
-    // check each node by breadth first traversal
-    std::vector<AVLNode<T>*> q;
-    q.push_back(root);
-    while (!q.empty())
+    const AVLNode<T>* node = root;
+    std::size_t smaller    = 0;
+    
+    // tree traversal, the left subtrees passed on the right are smaller
+    while (node)
     {
-        AVLNode<T>* node = q.front();
-        q.erase(q.begin());
-        if (node->left)
-            q.push_back(node->left);
-        if (node->right)
-            q.push_back(node->right);
-        
-        int balance = compute_node_balance(node);
-        if ( (balance < -1) || (balance > 1))
-            return false;
+        if (key > node->key)
+        {
+            smaller += node_size(node->left) + get_count(node);
+            node = node->right;
+        }
+        else if (key < node->key)
+            node = node->left;
+        else
+        // key found!
+            return smaller + node_size(node->left);
     }
     
-    return true;
+    return smaller;
 }
 
-// free all nodes of the tree
+// select an element by its position in ascending order, an element of
+// multiplicity m takes m consecutive positions
 // precondition: none
-// postcondition: all nodes freed and root set to nullptr
-template <class T>
-void AVLTree<T>::clear()
+// postcondition: return the node at the given position, nullptr if the
+// position is not less than the number of elements
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::select(std::size_t position) const
 {
-    if ( is_empty() )
-        return;
+    static_assert(has_sizes, "select requires node_sizes");
     
-    // delete each node by breadth first traversal
-    std::vector<AVLNode<T>*> q;
-    q.push_back(root);
-    while (!q.empty())
+    AVLNode<T>* node = root;
+    
+    // tree traversal
+    while (node)
     {
-        AVLNode<T>* node = q.front();
-        q.erase(q.begin());
-        if (node->left)
-            q.push_back(node->left);
-        if (node->right)
-            q.push_back(node->right);
-        delete node;
+        std::size_t left = node_size(node->left);
+        if (position < left)
+            node = node->left;
+        else if (position < left + get_count(node))
+            return node;
+        else
+        {
+            position -= left + get_count(node);
+            node = node->right;
+        }
     }
     
-    root = nullptr;
+    return nullptr;
 }
 
-// update the height attribute of an AVL node
-// after the node has been affected by a tree manipulation
+// multiplicity of the key of a node
 // precondition: valid node pointer is given
-// postcondition: height updated
-template <class T>
-void AVLTree<T>::update_height_node(AVLNode<T> *node)
+// postcondition: return the occurrences of the key, 0 for a tombstone,
+// always 1 without node_counts
+template <class T, class P>
+std::size_t AVLTree<T,P>::get_count(const AVLNode<T>* node)
 {
-    // the node has 2 children
-    if (node->right && node->left)
-        if (node->left->height > node->right->height)
-            node->height = node->left->height + 1;
-        else
-            node->height = node->right->height + 1;
-    // the node has only 1 child
-    else if (node->left)
-        node->height = node->left->height + 1;
-    else if (node->right)
-        node->height = node->right->height + 1;
-    // the node has no child
+    if constexpr (has_counts)
+        return fields(node)->count;
     else
-        node->height = 1;
+        return 1;
 }
 
-// insert a new key into the tree without balancing and updating heights
+// elements of the subtree of a node
+// precondition: valid node pointer is given
+// postcondition: return the elements counted with their multiplicity
+template <class T, class P>
+std::size_t AVLTree<T,P>::get_size(const AVLNode<T>* node)
+{
+    static_assert(has_sizes, "get_size requires node_sizes");
+    
+    return node_size(node);
+}
+
+// find a batch of keys. A group of lookups is kept in flight and advanced
+// in lock-step, one level at a time: the next node of each lookup is
+// prefetched and compared only when the other lookups of the group have
+// been advanced, so that the memory latency of the lookups overlaps. A lookup
+// that terminates is replaced by the next key of the batch.
 // precondition: none
-// postcondition: new node with the given key is inserted, the
-// resulting tree might be unbalanced, the heights are not updated
-template <class T>
-void AVLTree<T>::insertnb(T key, std::vector<AVLNode<T>*>& path)
+// postcondition: out holds, for each key, the pointer to its node if the
+// key is found, otherwise a nullptr
+template <class T, class P>
+void AVLTree<T,P>::find_batch(const std::vector<T>& keys, std::vector<AVLNode<T>*>& out)
+{
+    constexpr std::size_t group = 16;
+    
+    // lookups in flight, each one with its current node and key index
+    AVLNode<T>* nodes[group];
+    std::size_t indices[group];
+    std::size_t next   = 0;
+    std::size_t active = 0;
+    
+    out.resize(keys.size());
+    
+    if (recorder)
+        for (const T& key : keys)
+            trace(trace_find, key);
+    
+    if ( is_empty() )
+    {
+        std::fill(out.begin(), out.end(), nullptr);
+        return;
+    }
+    
+    if constexpr (is_hashable<T>::value)
+        if (hash_mode)
+        {
+            for (std::size_t k = 0; k < keys.size(); k++)
+            {
+                AVLNode<T>* node = index.find(keys[k]);
+                out[k] = (node && get_count(node)) ? node : nullptr;
+            }
+            return;
+        }
+    
+    for (; active < group && next < keys.size(); active++)
+    {
+        nodes[active]   = root;
+        indices[active] = next++;
+    }
+    
+    while (active > 0)
+    {
+        for (std::size_t k = 0; k < active; )
+        {
+            AVLNode<T>* node  = nodes[k];
+            AVLNode<T>* found = nullptr;
+            const T& key      = keys[indices[k]];
+            
+            if (key > node->key)
+                node = node->right;
+            else if (key < node->key)
+                node = node->left;
+            else
+            // key found, unless removed lazily
+            {
+                found = get_count(node) ? node : nullptr;
+                node  = nullptr;
+            }
+            
+            if (node)
+            {
+                // the next node is compared in the next round
+                __builtin_prefetch(node);
+                nodes[k++] = node;
+            }
+            else
+            {
+                out[indices[k]] = found;
+                
+                // start the next lookup or shrink the group
+                if (next < keys.size())
+                {
+                    nodes[k]     = root;
+                    indices[k++] = next++;
+                }
+                else
+                {
+                    active--;
+                    nodes[k]   = nodes[active];
+                    indices[k] = indices[active];
+                }
+            }
+        }
+    }
+}
+
+// remove an element from the tree by keeping the tree balanced
+// precondition: none
+// postcondition: node with the given key is removed
+// and the tree is kept balanced, node heights correctly updated
+template <class T, class P>
+void AVLTree<T,P>::remove(T key)
+{
+    std::vector<AVLNode<T>*> path;
+    
+    if constexpr (has_counts)
+        if (lazy_mode)
+        {
+            lazy_remove(key);
+            return;
+        }
+    
+    if (relaxed_mode)
+    {
+        unbalanced_remove(key);
+        return;
+    }
+    
+    trace(trace_remove, key);
+    
+    // complete the pending rebalancing first
+    if ( is_rebalance_pending() )
+        (void)rebalance_pending();
+    
+    // unbalanced remove
+    removenb(key,path);
+    
+    // rebalance the tree by rebalancing
+    // the traversed nodes during removal
+    if constexpr (P::rank_balanced)
+        rebalance_removal(path);
+    else
+        rebalance(path);
+}
+
+// remove an element from the tree without balancing the tree
+// precondition: none
+// postcondition: node with the given key is removed,
+// node heights correctly updated
+template <class T, class P>
+void AVLTree<T,P>::unbalanced_remove(T key)
+{
+    std::vector<AVLNode<T>*> path;
+    std::size_t before = modifications;
+    
+    trace(trace_remove, key);
+    
+    // unbalanced remove
+    removenb(key,path);
+    
+    // a remaining occurrence only changes the sizes along the path,
+    // otherwise update heights and mark the unbalanced nodes
+    if (modifications == before)
+        update_sizes(path, path.size());
+    else
+        mark_path(path);
+}
+
+// remove an element by turning its node into a tombstone, the search path is
+// the only work done and the tree keeps its structure until the compaction
+// precondition: none
+// postcondition: one occurrence of the key is removed, the node of the last
+// one is kept as a tombstone, the tree is compacted when the tombstones
+// exceed the compaction threshold
+template <class T, class P>
+void AVLTree<T,P>::lazy_remove(T key)
+{
+    std::vector<AVLNode<T>*> path;
+    AVLNode<T>* node = root;
+    
+    trace(trace_remove, key);
+    
+    // tree traversal
+    while (node)
+    {
+        path.push_back(node);
+        if (key > node->key)
+            node = node->right;
+        else if (key < node->key)
+            node = node->left;
+        else
+        // key found!
+            break;
+    }
+    
+    AVLTREE_SAMPLE(path_length, path.size());
+    
+    if (!node || fields(node)->count == 0)
+        return;
+    
+    if (--fields(node)->count == 0)
+        tombstones++;
+    update_sizes(path, path.size());
+    
+    if (tombstones > compaction_threshold * nodes)
+        rebuild(true);
+}
+
+
+// check whether the tree is balanced
+// precondition: none
+// postcondition: returns true if the balancing rule of the policy holds at
+// every node, false otherwise
+template <class T, class P>
+bool AVLTree<T,P>::is_balanced() const
+{
+    if ( is_empty() )
+        return true;
+    
+    // check each node by depth first traversal
+    std::vector<const AVLNode<T>*> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        const AVLNode<T>* node = stack.back();
+        stack.pop_back();
+        if (node->left)
+            stack.push_back(node->left);
+        if (node->right)
+            stack.push_back(node->right);
+        
+        if ( !P::is_valid(node->height, node_height(node->left), node_height(node->right)) )
+            return false;
+    }
+    
+    return true;
+}
+
+// check the structure of the tree: keys in strict order, sizes consistent
+// with the subtrees, and the balancing rule of the policy followed except at
+// the nodes marked for rebalancing, which only need consistent heights and
+// whose marks must cover every unbalanced node and its ancestors.
+// With more than one thread the subtrees a few levels below the root are
+// checked concurrently and the top of the tree is checked last.
+// precondition: the tree is not modified during the check
+// postcondition: returns true if the tree is consistent, false otherwise
+template <class T, class P>
+bool AVLTree<T,P>::validate(unsigned int threads) const
+{
+    std::vector<int> heights;
+    std::size_t next = 0;
+    int height       = 0;
+    
+    if (threads <= 1 || is_empty())
+        return validate_subtree(root, nullptr, nullptr, INT_MAX, heights, next, height);
+    
+    // split depth giving a few subtrees per thread
+    int split = 2;
+    while ((1u << split) < 4 * threads && split < 16)
+        split++;
+    
+    // subtrees at the split depth with their key bounds, from left to right
+    struct Subtree
+    {
+        const AVLNode<T>* node;
+        const T*          low;
+        const T*          high;
+        int               depth;
+    };
+    std::vector<Subtree> subtrees;
+    std::vector<Subtree> stack;
+    stack.push_back({root, nullptr, nullptr, 0});
+    while (!stack.empty())
+    {
+        Subtree subtree = stack.back();
+        stack.pop_back();
+        
+        if (subtree.depth == split)
+        {
+            subtrees.push_back(subtree);
+            continue;
+        }
+        
+        const AVLNode<T>* node = subtree.node;
+        if (node->right)
+            stack.push_back({node->right, &node->key, subtree.high, subtree.depth + 1});
+        if (node->left)
+            stack.push_back({node->left, subtree.low, &node->key, subtree.depth + 1});
+    }
+    
+    // check the subtrees, a failed subtree gets a negative height
+    heights.assign(subtrees.size(), -1);
+    std::atomic<std::size_t> task(0);
+    auto worker = [&]()
+    {
+        std::vector<int> none;
+        for (std::size_t k = task++; k < subtrees.size(); k = task++)
+        {
+            std::size_t unused = 0;
+            int subtree_height = 0;
+            if (validate_subtree(subtrees[k].node, subtrees[k].low, subtrees[k].high, INT_MAX,
+                                 none, unused, subtree_height))
+                heights[k] = subtree_height;
+        }
+    };
+    
+    std::vector<std::thread> pool;
+    for (unsigned int k = 1; k < threads; k++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool)
+        thread.join();
+    
+    // check the top of the tree with the heights of the subtrees
+    return validate_subtree(root, nullptr, nullptr, split, heights, next, height);
+}
+
+// post-order check of a subtree without recursion. The nodes at the split
+// depth are not visited, their heights are taken in order from the given
+// heights instead
+// precondition: key bounds of the subtree, nullptr when unbounded
+// postcondition: returns true and the height of the subtree if the subtree
+// is consistent, false otherwise
+template <class T, class P>
+bool AVLTree<T,P>::validate_subtree(const AVLNode<T>* node, const T* low, const T* high, int split,
+                                  const std::vector<int>& heights, std::size_t& next, int& height) const
+{
+    struct Frame
+    {
+        const AVLNode<T>* node;
+        const T*          low;
+        const T*          high;
+        int               depth;
+        int               stage;
+        int               left_height;
+        std::size_t       left_size;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({node, low, high, 0, 0, 0, 0});
+    
+    // height and size of the last subtree checked
+    height           = 0;
+    std::size_t size = 0;
+    
+    while (!stack.empty())
+    {
+        Frame& frame = stack.back();
+        const AVLNode<T>* current = frame.node;
+        
+        if (frame.stage == 0)
+        {
+            if (!current)
+            {
+                height = 0;
+                size   = 0;
+                stack.pop_back();
+                continue;
+            }
+            
+            // the size of a checked subtree is the stored one
+            if (frame.depth == split)
+            {
+                if (next >= heights.size() || heights[next] < 0)
+                    return false;
+                height = heights[next++];
+                size   = node_size(current);
+                stack.pop_back();
+                continue;
+            }
+            
+            // the key must lie strictly within the bounds
+            if ( (frame.low && !(*frame.low < current->key)) || (frame.high && !(current->key < *frame.high)) )
+                return false;
+            
+            frame.stage = 1;
+            Frame left  = {current->left, frame.low, &current->key, frame.depth + 1, 0, 0, 0};
+            stack.push_back(left);
+        }
+        else if (frame.stage == 1)
+        {
+            frame.left_height = height;
+            frame.left_size   = size;
+            frame.stage       = 2;
+            Frame right = {current->right, &current->key, frame.high, frame.depth + 1, 0, 0, 0};
+            stack.push_back(right);
+        }
+        else
+        {
+            int left_height  = frame.left_height;
+            int right_height = height;
+            bool dirty_child = node_marked(current->left) || node_marked(current->right);
+            
+            // a marked node only needs a consistent height
+            bool valid = node_marked(current) ? current->height == std::max(left_height, right_height) + 1
+                                              : P::is_valid(current->height, left_height, right_height);
+            
+            height = current->height;
+            size   = frame.left_size + size + get_count(current);
+            
+            if (!valid || (has_sizes && node_size(current) != size))
+                return false;
+            if (dirty_child && !node_marked(current))
+                return false;
+            
+            stack.pop_back();
+        }
+    }
+    
+    return true;
+}
+
+// snapshot of the operation counters
+// precondition: none
+// postcondition: return the counters of the tree, all zero if the tree is
+// compiled without AVLTREE_STATS
+template <class T, class P>
+AVLTreeStats AVLTree<T,P>::stats() const
+{
+#ifdef AVLTREE_STATS
+    return counters.snapshot();
+#else
+    return AVLTreeStats{};
+#endif
+}
+
+// reset the operation counters
+// precondition: none
+// postcondition: all counters set to zero
+template <class T, class P>
+void AVLTree<T,P>::reset_stats()
+{
+#ifdef AVLTREE_STATS
+    counters.reset();
+#endif
+}
+
+// append an operation to the trace, keys that cannot be copied as bytes
+// are not recorded
+// precondition: none
+// postcondition: operation recorded if a recorder is set
+template <class T, class P>
+void AVLTree<T,P>::trace(AVLTraceOperation operation, const T& key)
+{
+    if constexpr (std::is_trivially_copyable<T>::value)
+    {
+        if (recorder)
+            recorder->record(operation, key);
+    }
+    else
+    {
+        (void)operation;
+        (void)key;
+    }
+}
+
+// free all nodes of the tree
+// precondition: none
+// postcondition: all nodes freed and root set to nullptr
+template <class T, class P>
+void AVLTree<T,P>::clear()
+{
+    end_compaction();
+    
+    if ( is_empty() )
+        return;
+    
+    // delete each node by depth first traversal
+    std::vector<AVLNode<T>*> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        AVLNode<T>* node = stack.back();
+        stack.pop_back();
+        if (node->left)
+            stack.push_back(node->left);
+        if (node->right)
+            stack.push_back(node->right);
+        delete_node(node);
+    }
+    
+    root       = nullptr;
+    tombstones = 0;
+    hand_valid = false;
+    modifications++;
+}
+
+// allocate a node
+// precondition: none
+// postcondition: return a new leaf node with the given key, indexed in
+// hash mode
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::new_node(T key)
+{
+    AVLTREE_COUNT(node_allocation);
+    nodes++;
+    
+    AVLNode<T>* node = new Node(key);
+    memory_bytes    += allocation_size(sizeof(Node)) + key_heap_bytes(node->key);
+    
+    if constexpr (is_hashable<T>::value)
+        if (hash_mode)
+            index.insert(node->key, node);
+    
+    update_peak();
+    
+    return node;
+}
+
+// free a node
+// precondition: the node is not referenced by the tree anymore
+// postcondition: node deleted and removed from the hash index and the cache
+template <class T, class P>
+void AVLTree<T,P>::delete_node(AVLNode<T>* node)
+{
+    AVLTREE_COUNT(node_free);
+    nodes--;
+    memory_bytes -= key_heap_bytes(node->key);
+    
+    if constexpr (is_hashable<T>::value)
+    {
+        if (hash_mode)
+            index.erase(node->key);
+        if (cache_mode)
+            cache.erase(node->key, node);
+    }
+    
+    release_node(node);
+}
+
+// free the memory of a node, either on the heap or in a compaction block
+// precondition: the node is not referenced by the tree anymore
+// postcondition: node destroyed, its block freed if it was the last node
+template <class T, class P>
+void AVLTree<T,P>::release_node(AVLNode<T>* node)
+{
+    // last block starting at or before the node
+    Node* full = fields(node);
+    typename Arenas::iterator block = arenas.upper_bound(full);
+    if (block != arenas.begin())
+    {
+        Arena& arena = (--block)->second;
+        std::less<const Node*> before;
+        if ( before(full, arena.nodes + arena.used) )
+        {
+            full->~Node();
+            // the block being filled is kept until the compaction ends
+            if (--arena.live == 0 && !(compacting && block == filling))
+            {
+                memory_bytes -= allocation_size(arena.capacity * sizeof(Node));
+                std::allocator<Node>().deallocate(arena.nodes, arena.capacity);
+                arenas.erase(block);
+            }
+            return;
+        }
+    }
+    
+    memory_bytes -= allocation_size(sizeof(Node));
+    delete full;
+}
+
+// allocate a block for the compaction and make it the block being filled
+// precondition: capacity greater than 0
+// postcondition: empty block added and charged to the memory usage
+template <class T, class P>
+void AVLTree<T,P>::new_arena(std::size_t capacity)
+{
+    Node* block = std::allocator<Node>().allocate(capacity);
+    filling = arenas.insert({ block, Arena{ block, capacity, 0, 0 } }).first;
+    memory_bytes += allocation_size(capacity * sizeof(Node));
+    update_peak();
+}
+
+// copy a node into the next free slot of the block being filled and free
+// the node
+// precondition: the block is not full, the caller links the copy in place
+// of the node
+// postcondition: return the copy, indexed in hash mode and cached in place
+// of the node
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::move_node(AVLNode<T>* node)
+{
+    Arena& arena     = filling->second;
+    AVLNode<T>* copy = new (arena.nodes + arena.used) Node(*fields(node));
+    arena.used++;
+    arena.live++;
+    
+    if constexpr (is_hashable<T>::value)
+    {
+        if (hash_mode)
+            index.move(copy->key, copy);
+        if (cache_mode)
+            cache.move(copy->key, node, copy);
+    }
+    
+    release_node(node);
+    
+    return copy;
+}
+
+// move all the nodes into a new block in key order by a single in-order
+// traversal. Each stack entry holds a node and the link to set to the
+// address of its copy: the left link of its parent, which is not followed
+// anymore once the node is reached, or the right link of the copy of its
+// parent
+// precondition: none
+// postcondition: the nodes are contiguous in key order, the fingers and the
+// pending rebalancing position are invalidated
+template <class T, class P>
+void AVLTree<T,P>::relocate()
+{
+    end_compaction();
+    
+    if ( is_empty() )
+        return;
+    
+    modifications++;
+    pending.clear();
+    finger.clear();
+    
+    new_arena(nodes);
+    // the block of the copies must outlive the release of the moved nodes
+    compacting = true;
+    
+    std::vector<std::pair<AVLNode<T>*, AVLNode<T>**>> stack;
+    AVLNode<T>*  node = root;
+    AVLNode<T>** link = &root;
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back({node, link});
+            link = &node->left;
+            node = node->left;
+        }
+        
+        node = stack.back().first;
+        link = stack.back().second;
+        stack.pop_back();
+        
+        AVLNode<T>* right = node->right;
+        AVLNode<T>* copy  = move_node(node);
+        *link = copy;
+        
+        node = right;
+        link = &copy->right;
+    }
+    
+    compacting = false;
+}
+
+// move the nodes into a new block in key order, each node being found by a
+// descent from the root to the successor of the last moved key, so that the
+// tree can be modified between the calls. The nodes inserted meanwhile are
+// moved too if their keys come later and the block has room left
+// precondition: none
+// postcondition: return true when all the nodes have been visited, the
+// fingers and the pending rebalancing position are invalidated
+template <class T, class P>
+bool AVLTree<T,P>::compact_incremental(std::chrono::nanoseconds budget)
+{
+    using Clock = std::chrono::steady_clock;
+    auto deadline = Clock::now() + budget;
+    
+    if (!compacting)
+    {
+        if ( is_empty() )
+            return true;
+        
+        new_arena(nodes);
+        compacting   = true;
+        cursor_valid = false;
+    }
+    
+    modifications++;
+    pending.clear();
+    finger.clear();
+    
+    for (std::size_t moved = 1; ; moved++)
+    {
+        // link to the first node with a key after the cursor
+        AVLNode<T>** next = nullptr;
+        AVLNode<T>** link = &root;
+        while (*link)
+        {
+            if (!cursor_valid || (*link)->key > cursor)
+            {
+                next = link;
+                link = &(*link)->left;
+            }
+            else
+                link = &(*link)->right;
+        }
+        
+        if (!next || filling->second.used == filling->second.capacity)
+        {
+            end_compaction();
+            return true;
+        }
+        
+        cursor       = (*next)->key;
+        cursor_valid = true;
+        
+        // a removal may have moved a later key into a copied node
+        Arena& arena = filling->second;
+        std::less<const Node*> before;
+        if (before(fields(*next), arena.nodes) || !before(fields(*next), arena.nodes + arena.used))
+            *next = move_node(*next);
+        
+        // check the clock every few nodes
+        if (moved % 32 == 0 && Clock::now() >= deadline)
+            return false;
+    }
+}
+
+// stop the incremental compaction
+// precondition: none
+// postcondition: block being filled freed if empty
+template <class T, class P>
+void AVLTree<T,P>::end_compaction()
+{
+    if (!compacting)
+        return;
+    
+    compacting   = false;
+    cursor_valid = false;
+    if (filling->second.live == 0)
+    {
+        memory_bytes -= allocation_size(filling->second.capacity * sizeof(Node));
+        std::allocator<Node>().deallocate(filling->second.nodes, filling->second.capacity);
+        arenas.erase(filling);
+    }
+}
+
+// switch the hash index on or off. Switching it on indexes all the nodes, a
+// lower maximum load factor makes the index larger and the probes shorter
+// precondition: load factor in ]0,1[, keys supported by std::hash
+// postcondition: return false and leave the tree unchanged if the load
+// factor is not in ]0,1[, otherwise index built or freed and return true
+template <class T, class P>
+bool AVLTree<T,P>::set_hash_mode(bool mode, double max_load)
+{
+    static_assert(is_hashable<T>::value, "hash mode requires keys supported by std::hash");
+    
+    if ( !index.set_max_load(max_load) )
+        return false;
+    
+    hash_mode = mode;
+    index.clear();
+    
+    if (!mode || is_empty())
+        return true;
+    
+    // index each node by depth first traversal
+    std::vector<AVLNode<T>*> stack;
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        AVLNode<T>* node = stack.back();
+        stack.pop_back();
+        if (node->left)
+            stack.push_back(node->left);
+        if (node->right)
+            stack.push_back(node->right);
+        index.insert(node->key, node);
+    }
+    
+    update_peak();
+    
+    return true;
+}
+
+// switch the cache of the hot keys on or off, the cache starts empty and is
+// filled by the following lookups
+// precondition: keys supported by std::hash
+// postcondition: cache of the given number of slots allocated or freed,
+// counters reset
+template <class T, class P>
+void AVLTree<T,P>::set_cache_mode(bool mode, std::size_t entries)
+{
+    static_assert(is_hashable<T>::value, "cache mode requires keys supported by std::hash");
+    
+    cache_mode = mode;
+    cache.resize(mode ? entries : 0);
+    update_peak();
+}
+
+// set the memory limit and the eviction policy, the nodes exceeding the new
+// limit are evicted at once
+// precondition: none
+// postcondition: return false and leave the tree unchanged for evict_lru
+// without node_references, otherwise memory usage within the limit, or the
+// tree empty, and return true
+template <class T, class P>
+bool AVLTree<T,P>::set_memory_limit(std::size_t bytes, AVLEvictionPolicy policy)
+{
+    if (policy == evict_lru && !has_references)
+        return false;
+    
+    memory_limit    = bytes;
+    eviction_policy = policy;
+    hand_valid      = false;
+    
+    enforce_memory_limit();
+    return true;
+}
+
+// evict nodes until the memory usage is within the limit. A victim is
+// removed as a whole, with all its occurrences in multiset mode and even if
+// it is a tombstone in lazy mode, so that its memory is freed at once
+// precondition: none
+// postcondition: memory usage within the limit, or the tree empty
+template <class T, class P>
+void AVLTree<T,P>::enforce_memory_limit()
+{
+    while (memory_limit && root && memory_usage() > memory_limit)
+    {
+        AVLNode<T>* victim = eviction_victim();
+        T key = victim->key;
+        if constexpr (has_counts)
+            if (fields(victim)->count > 1)
+                fields(victim)->count = 1;
+        evictions++;
+        
+        std::vector<AVLNode<T>*> path;
+        if (relaxed_mode)
+        {
+            removenb(key, path);
+            mark_path(path);
+            continue;
+        }
+        
+        // complete the pending rebalancing first
+        if ( is_rebalance_pending() )
+            (void)rebalance_pending();
+        
+        removenb(key, path);
+        if constexpr (P::rank_balanced)
+            rebalance_removal(path);
+        else
+            rebalance(path);
+    }
+}
+
+// node to evict by the eviction policy. For evict_lru the hand of the clock
+// sweeps the keys in ascending order, wrapping around at the end: it clears
+// the mark of the nodes found since its last pass and stops at the first
+// node not marked, at most one sweep away. The new nodes are not marked, so
+// keys inserted but never looked up leave first
+// precondition: tree not empty
+// postcondition: return the node to evict
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::eviction_victim()
+{
+    AVLNode<T>* node = root;
+    
+    if (eviction_policy == evict_smallest)
+    {
+        while (node->left)
+            node = node->left;
+        return node;
+    }
+    
+    if (eviction_policy == evict_largest)
+    {
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+    
+    if constexpr (has_references)
+    {
+        node = hand_valid ? next_node(hand, true) : nullptr;
+        while (true)
+        {
+            // wrap around to the smallest key
+            if (!node)
+            {
+                node = root;
+                while (node->left)
+                    node = node->left;
+            }
+            if (!fields(node)->referenced)
+                break;
+            fields(node)->referenced = false;
+            node = next_node(node->key, false);
+        }
+        
+        hand       = node->key;
+        hand_valid = true;
+    }
+    
+    return node;
+}
+
+// first node of a key not smaller than the given key, or greater if not
+// inclusive
+// precondition: none
+// postcondition: return the node, nullptr if there is none
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::next_node(const T& key, bool inclusive) const
+{
+    AVLNode<T>* node = root;
+    AVLNode<T>* next = nullptr;
+    
+    // tree traversal, the last node passed on the left is the successor
+    while (node)
+    {
+        if (key < node->key || (inclusive && !(key > node->key)))
+        {
+            next = node;
+            node = node->left;
+        }
+        else
+            node = node->right;
+    }
+    
+    return next;
+}
+
+// update the height attribute of an AVL node
+// after the node has been affected by a tree manipulation
+// precondition: valid node pointer is given
+// postcondition: height updated
+template <class T, class P>
+void AVLTree<T,P>::update_height_node(AVLNode<T> *node)
+{
+    // the node has 2 children
+    if (node->right && node->left)
+        if (node->left->height > node->right->height)
+            node->height = node->left->height + 1;
+        else
+            node->height = node->right->height + 1;
+    // the node has only 1 child
+    else if (node->left)
+        node->height = node->left->height + 1;
+    else if (node->right)
+        node->height = node->right->height + 1;
+    // the node has no child
+    else
+        node->height = 1;
+    
+    update_size_node(node);
+}
+
+// update the size and the summary of the subtree of a node
+// after the node or its children have changed
+// precondition: valid node pointer is given, the children are up to date
+// postcondition: size and summary updated
+template <class T, class P>
+void AVLTree<T,P>::update_size_node(AVLNode<T>* node)
+{
+    // elements of the subtree
+    if constexpr (has_sizes)
+        fields(node)->size = get_count(node) + node_size(node->left) + node_size(node->right);
+    
+    if constexpr (is_augmented<T>::value)
+        node->key.augment(node->left ? &node->left->key : nullptr, node->right ? &node->right->key : nullptr);
+}
+
+// insert a new key into the tree without balancing and updating heights
+// precondition: none
+// postcondition: new node with the given key is inserted, the
+// resulting tree might be unbalanced, the heights are not updated
+template <class T, class P>
+void AVLTree<T,P>::insertnb(T key, std::vector<AVLNode<T>*>& path)
 {
+    trace(trace_insert, key);
+    
     if ( is_empty() )
     {
         root = new_node(key);
+        modifications++;
         return;
     }
     
+    AVLKeySearch<T> search(key);
     AVLNode<T>* parent = root;
     AVLNode<T>* node   = root;
+    int order = 0;
     
     // tree traversal
     while (node)
     {
         parent = node;
         path.push_back(parent);
-        if (key > node->key)
+        order  = search.compare(node->key);
+        if (order > 0)
             node = node->right;
-        else if (key < node->key)
+        else if (order < 0)
             node = node->left;
         else
         // key already present!
         {
+            AVLTREE_SAMPLE(path_length, path.size());
+            // one more occurrence, a tombstone comes back to life, the
+            // sizes along the path are updated by the caller
+            if constexpr (has_counts)
+            {
+                if (multiset_mode || fields(node)->count == 0)
+                {
+                    if (fields(node)->count == 0)
+                        tombstones--;
+                    fields(node)->count++;
+                    return;
+                }
+            }
             path.clear();
             return;
         }
     }
     
+    AVLTREE_SAMPLE(path_length, path.size());
+    
+    modifications++;
+    
     // insert node
-    if (key > parent->key)
+    if (order > 0)
         parent->right = new_node(key);
     else
         parent->left = new_node(key);
@@ -389,12 +1906,13 @@ void AVLTree<T>::insertnb(T key, std::vector<AVLNode<T>*>& path)
 // precondition: none
 // postcondition: existing node with the given key is removed, the
 // resulting tree might be unbalanced, the heights are not updated
-template <class T>
-void AVLTree<T>::removenb(T key, std::vector<AVLNode<T>*>& path)
+template <class T, class P>
+void AVLTree<T,P>::removenb(T key, std::vector<AVLNode<T>*>& path)
 {
     if ( is_empty() )
         return;
     
+    AVLKeySearch<T> search(key);
     AVLNode<T>* parent = root;
     AVLNode<T>* node   = root;
     bool found = false;
@@ -404,22 +1922,38 @@ void AVLTree<T>::removenb(T key, std::vector<AVLNode<T>*>& path)
     {
         parent = node;
         path.push_back(parent);
-        if (key > node->key)
+        int order = search.compare(node->key);
+        if (order > 0)
             node = node->right;
-        else if (key < node->key)
+        else if (order < 0)
             node = node->left;
         else
         // key found!
             found = true;
     }
     
+    AVLTREE_SAMPLE(path_length, path.size());
+    
     if (!found)
     {
         path.clear();
         return;
     }
+    else if (multiset_mode && get_count(node) > 1)
+    {
+        // one occurrence less, the node and the path keep their shape
+        if constexpr (has_counts)
+            fields(node)->count--;
+        return;
+    }
     else
     {
+        modifications++;
+        
+        // a tombstone is purged as well
+        if (get_count(node) == 0)
+            tombstones--;
+        
         // remove the node from the path
         path.pop_back();
         
@@ -430,8 +1964,12 @@ void AVLTree<T>::removenb(T key, std::vector<AVLNode<T>*>& path)
             // take pointer to parent node
             parent = path.back();
         
-        // cut off the node from the tree
-        cut_off_node(node,parent,path);
+        // cut off the node from the tree, the rank rules need the
+        // successor to take its place instead
+        if constexpr (P::rank_balanced)
+            splice_node(node,parent,path);
+        else
+            cut_off_node(node,parent,path);
     }
 }
 
@@ -440,8 +1978,8 @@ void AVLTree<T>::removenb(T key, std::vector<AVLNode<T>*>& path)
 // postcondition: all the references to the given node are removed from the
 // parent, the child with the greater height or key is promoted as the
 // parent's child and the sibling is reinserted into the tree
-template <class T>
-void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<AVLNode<T>*>& path)
+template <class T, class P>
+void AVLTree<T,P>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<AVLNode<T>*>& path)
 {
     // no children?
     if (!node->left && !node->right)
@@ -455,7 +1993,7 @@ void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<
         else
             parent->right = nullptr;
         
-        delete node;
+        delete_node(node);
     }
     // no right child
     else if (node->left && !node->right)
@@ -469,7 +2007,7 @@ void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<
         else
             parent->right = node->left;
         
-        delete node;
+        delete_node(node);
     }
     // no left child
     else if (!node->left && node->right)
@@ -483,7 +2021,7 @@ void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<
         else
             parent->right = node->right;
         
-        delete node;
+        delete_node(node);
     }
     // both children are there
     else
@@ -522,7 +2060,9 @@ void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<
         else
             parent->right = child;
         
-        delete node;
+        delete_node(node);
+        
+        AVLTREE_COUNT(sibling_reinsertion);
         
         // insert sibling starting from the child
         node = child;
@@ -544,12 +2084,69 @@ void AVLTree<T>::cut_off_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<
     }
 }
 
+// splice a node out of the tree. A node with at most one child is replaced
+// by its child, a node with two children by its successor, which is unlinked
+// from the right subtree and takes the place and the height of the node
+// precondition: path from the root to the parent of the node
+// postcondition: node deleted, the path goes down to the node whose child
+// has been unlinked
+template <class T, class P>
+void AVLTree<T,P>::splice_node(AVLNode<T>* node, AVLNode<T>* parent, std::vector<AVLNode<T>*>& path)
+{
+    AVLNode<T>* child = nullptr;
+    
+    if (node->left && node->right)
+    {
+        // the successor is the leftmost node of the right subtree
+        std::size_t level     = path.size();
+        AVLNode<T>* above     = node;
+        AVLNode<T>* successor = node->right;
+        path.push_back(node);
+        while (successor->left)
+        {
+            above     = successor;
+            successor = successor->left;
+            path.push_back(above);
+        }
+        
+        // unlink the successor
+        if (above == node)
+            node->right = successor->right;
+        else
+            above->left = successor->right;
+        
+        // the successor takes the place of the node
+        successor->left   = node->left;
+        successor->right  = node->right;
+        successor->height = node->height;
+        if constexpr (has_marks)
+            fields(successor)->dirty = fields(node)->dirty;
+        path[level]       = successor;
+        child             = successor;
+    }
+    else if (node->left)
+        child = node->left;
+    else
+        child = node->right;
+    
+    // update root
+    if (!parent)
+        root = child;
+    // update parent node
+    else if (parent->left == node)
+        parent->left  = child;
+    else
+        parent->right = child;
+    
+    delete_node(node);
+}
+
 // return the balance factor of a node as the difference
 // between the left and right subtree heights
 // precondition: valid node pointer is given
 // postcondition: balance factor calculated
-template <class T>
-int AVLTree<T>::compute_node_balance(AVLNode<T>* node) const
+template <class T, class P>
+int AVLTree<T,P>::compute_node_balance(AVLNode<T>* node) const
 {
     // no node?
     if (!node)
@@ -572,17 +2169,26 @@ int AVLTree<T>::compute_node_balance(AVLNode<T>* node) const
 // rebalance the tree by rebalancing the traversed nodes during insertion
 // precondition: none
 // postcondition: tree rebalanced and heights updated
-template <class T>
-void AVLTree<T>::rebalance(std::vector<AVLNode<T>*>& path)
+template <class T, class P>
+void AVLTree<T,P>::rebalance(std::vector<AVLNode<T>*>& path)
 {
     AVLNode<T>* node     = nullptr;
     AVLNode<T>* new_node = nullptr;
+#ifdef AVLTREE_STATS
+    // levels from the bottom of the path to the last rotation or height change
+    std::size_t size  = path.size();
+    std::size_t depth = 0;
+#endif
     
     while (!path.empty())
     {
         // get a node from the traversed path
         node = path.back();
         path.pop_back();
+
+#ifdef AVLTREE_STATS
+        int height = node->height;
+#endif
         
         // get its previous node
         AVLNode<T>* parent = nullptr;
@@ -614,14 +2220,606 @@ void AVLTree<T>::rebalance(std::vector<AVLNode<T>*>& path)
             new_node = node;
         
         update_height_node(new_node);
+
+#ifdef AVLTREE_STATS
+        if (new_node != node || node->height != height)
+            depth = size - path.size();
+#endif
+    }
+    
+    AVLTREE_SAMPLE(rebalance_depth, depth);
+}
+
+// rebalance the ancestors of a removed node by the rank rules. Going up the
+// path, a leaf of rank 1 is demoted, and so is a node having a child 3 ranks
+// below it, together with its sibling when the sibling is a 1-child whose
+// children are both 2-children. The first node following the rules ends the
+// rebalancing, as does a single or double rotation when the sibling cannot be
+// demoted. The sizes of the remaining ancestors are still updated.
+// precondition: path from the root to the node whose child has been
+// unlinked, the rest of the tree follows the rank rules
+// postcondition: tree rebalanced, heights and sizes updated, path emptied
+template <class T, class P>
+void AVLTree<T,P>::rebalance_removal(std::vector<AVLNode<T>*>& path)
+{
+#ifdef AVLTREE_STATS
+    // levels from the bottom of the path to the last rotation or demotion
+    std::size_t size  = path.size();
+    std::size_t depth = 0;
+#endif
+    
+    while (!path.empty())
+    {
+        // get a node from the traversed path
+        AVLNode<T>* node = path.back();
+        path.pop_back();
+        
+        // get its previous node
+        AVLNode<T>* parent = nullptr;
+        if (!path.empty())
+            parent = path.back();
+        
+        update_size_node(node);
+        
+        bool left_low  = node->height - node_height(node->left) > 2;
+        bool right_low = node->height - node_height(node->right) > 2;
+        
+        // a leaf of rank 1 is demoted
+        if (!node->left && !node->right && node->height > 1)
+            node->height = 1;
+        else if (!left_low && !right_low)
+            break;
+        else
+        {
+            AVLNode<T>* sibling = left_low ? node->right : node->left;
+            
+            // the sibling is a 2-child, the node is demoted
+            if (node->height - sibling->height == 2)
+                node->height--;
+            // the sibling has two 2-children, both are demoted
+            else if (sibling->height - node_height(sibling->left) == 2 &&
+                     sibling->height - node_height(sibling->right) == 2)
+            {
+                node->height--;
+                sibling->height--;
+            }
+            else
+            {
+                int height           = node->height;
+                int sibling_height   = sibling->height;
+                AVLNode<T>* inner    = left_low ? sibling->left : sibling->right;
+                int inner_height     = node_height(inner);
+                AVLNode<T>* new_node = left_low ? rebalance_to_left(node, parent)
+                                                : rebalance_to_right(node, parent);
+                
+                // single rotation, the sibling goes up
+                if (new_node == sibling)
+                {
+                    sibling->height = sibling_height + 1;
+                    node->height    = (node->left || node->right) ? height - 1 : 1;
+                }
+                // double rotation, the inner child of the sibling goes up
+                else
+                {
+                    inner->height   = inner_height + 2;
+                    sibling->height = sibling_height - 1;
+                    node->height    = height - 2;
+                    (void)compute_node_balance(inner);
+                }
+                (void)compute_node_balance(node);
+                (void)compute_node_balance(sibling);
+
+#ifdef AVLTREE_STATS
+                depth = size - path.size();
+#endif
+                break;
+            }
+        }
+        
+        (void)compute_node_balance(node);
+
+#ifdef AVLTREE_STATS
+        depth = size - path.size();
+#endif
+    }
+    
+    update_sizes(path, path.size());
+    path.clear();
+    
+    AVLTREE_SAMPLE(rebalance_depth, depth);
+}
+
+// rebalance the ancestors of a newly inserted node. Going up from the parent
+// of the new node, the heights are updated until a node keeps its height,
+// since then none of its ancestors change. On insertion at most one single or
+// double rotation is needed, after which the subtree is back to its height
+// before the insertion, so the rebalancing stops there as well. The sizes of
+// the remaining ancestors are still updated.
+// precondition: the first size nodes of the path are the ancestors of the
+// new node, starting from the root
+// postcondition: tree rebalanced, heights and sizes updated up to the top level
+// of the path, return the level of the path where the rotation took place, -1
+// if no rotation was needed
+template <class T, class P>
+int AVLTree<T,P>::rebalance_insertion(const std::vector<AVLNode<T>*>& path, std::size_t size, std::size_t top)
+{
+    for (std::size_t level = size; level-- > top; )
+    {
+        AVLNode<T>* node   = path[level];
+        AVLNode<T>* parent = level ? path[level - 1] : nullptr;
+        int height         = node->height;
+        
+        int balance = compute_node_balance(node);
+        
+        AVLNode<T>* new_node = nullptr;
+        if (balance > 1)
+            new_node = rebalance_to_right(node,parent);
+        else if (balance < -1)
+            new_node = rebalance_to_left(node,parent);
+        else
+        {
+            update_height_node(node);
+            if (node->height == height)
+            {
+                AVLTREE_SAMPLE(rebalance_depth, size - level - 1);
+                // the ancestors keep their heights but not their sizes
+                update_sizes(path, level, top);
+                return -1;
+            }
+            continue;
+        }
+        
+        // update the balances of the rotated nodes
+        (void)compute_node_balance(node);
+        (void)compute_node_balance(new_node);
+        
+        AVLTREE_SAMPLE(rebalance_depth, size - level);
+        
+        update_sizes(path, level, top);
+        
+        return static_cast<int>(level);
+    }
+    
+    AVLTREE_SAMPLE(rebalance_depth, size - top);
+    
+    return -1;
+}
+
+// elements of a subtree, 0 for an empty one
+// precondition: none
+// postcondition: return the size of the subtree, 0 without node_sizes
+template <class T, class P>
+std::size_t AVLTree<T,P>::node_size(const AVLNode<T>* node)
+{
+    if constexpr (has_sizes)
+        return node ? fields(node)->size : 0;
+    else
+        return 0;
+}
+
+// mark of a node to be rebalanced
+// precondition: none
+// postcondition: return true if the node exists and is marked, always false
+// without node_marks
+template <class T, class P>
+bool AVLTree<T,P>::node_marked(const AVLNode<T>* node)
+{
+    if constexpr (has_marks)
+        return node && fields(node)->dirty;
+    else
+        return false;
+}
+
+// copy the optional fields of a node
+// precondition: valid node pointers are given
+// postcondition: the copy has the multiplicity, size and marks of the node
+template <class T, class P>
+void AVLTree<T,P>::copy_fields(AVLNode<T>* copy, const AVLNode<T>* node)
+{
+    if constexpr (has_counts)
+        fields(copy)->count = fields(node)->count;
+    if constexpr (has_sizes)
+        fields(copy)->size = fields(node)->size;
+    if constexpr (has_marks)
+        fields(copy)->dirty = fields(node)->dirty;
+    if constexpr (has_references)
+        fields(copy)->referenced = fields(node)->referenced;
+}
+
+// update the sizes of the nodes of a path going up
+// precondition: the first size nodes of the path are a chain of ancestors
+// starting from the root, the subtrees below them have correct sizes
+// postcondition: sizes and summaries of the nodes between the top and size
+// levels updated
+template <class T, class P>
+void AVLTree<T,P>::update_sizes(const std::vector<AVLNode<T>*>& path, std::size_t size, std::size_t top)
+{
+    if constexpr (!has_sizes && !is_augmented<T>::value)
+        return;
+    
+    for (std::size_t level = size; level-- > top; )
+        update_size_node(path[level]);
+}
+
+// find the deepest node of the hint path whose subtree covers the key. The
+// subtree of a node is bounded by its nearest ancestors having the node in
+// their left and right subtree, the search follows these ancestors only
+// precondition: non empty hint path starting from the root
+// postcondition: return the level of the node in the hint path
+template <class T, class P>
+std::size_t AVLTree<T,P>::finger_level(const AVLFinger<T>& hint, T key) const
+{
+    const std::vector<AVLNode<T>*>& path = hint.path;
+    int level = static_cast<int>(path.size()) - 1;
+    
+    if (key > path[level]->key)
+    {
+        // climb while the upper bound is not greater than the key
+        int bound = hint.left_turn[level];
+        while (bound >= 0 && !(key < path[bound]->key))
+        {
+            level = bound;
+            bound = hint.left_turn[bound];
+        }
+    }
+    else if (key < path[level]->key)
+    {
+        // climb while the lower bound is not smaller than the key
+        int bound = hint.right_turn[level];
+        while (bound >= 0 && !(key > path[bound]->key))
+        {
+            level = bound;
+            bound = hint.right_turn[bound];
+        }
+    }
+    
+    return static_cast<std::size_t>(level);
+}
+
+// load sorted keys as a vine of new nodes hanging at the right of the root,
+// folded into a complete tree as by rebuild. Equal neighbours add to the
+// multiplicity in multiset mode and are dropped otherwise
+// precondition: keys in ascending order
+// postcondition: the tree holds the keys, balanced
+template <class T, class P>
+void AVLTree<T,P>::bulk_load(const std::vector<T>& keys)
+{
+    clear();
+    
+    AVLNode<T>* last = nullptr;
+    for (const T& key : keys)
+    {
+        if (last && !(last->key < key))
+        {
+            if constexpr (has_counts)
+                if (multiset_mode)
+                    fields(last)->count++;
+            continue;
+        }
+        
+        AVLNode<T>* node = new_node(key);
+        if (last)
+            last->right = node;
+        else
+            root = node;
+        last = node;
     }
+    
+    rebuild(false);
+    enforce_memory_limit();
+}
+
+// rebuild the tree in place with the Day-Stout-Warren algorithm: the tree is
+// first unrolled into a sorted vine by right rotations, then the vine is
+// folded back into a complete tree by rounds of left rotations. With purge the
+// tombstones are unlinked from the vine and deleted before folding it.
+// precondition: none
+// postcondition: the tree is perfectly balanced, all the leaves are on the last
+// two levels, heights and balances are updated and no node is marked, no
+// tombstone is left if purged
+template <class T, class P>
+void AVLTree<T,P>::rebuild(bool purge)
+{
+    if ( is_empty() )
+        return;
+    
+    modifications++;
+    pending.clear();
+    
+    AVLNode<T> pseudo_root;
+    pseudo_root.right = root;
+    
+    std::size_t size = tree_to_vine(&pseudo_root);
+    
+    if (purge)
+        size -= purge_vine(&pseudo_root);
+    
+    // number of nodes in the last level of the complete tree
+    std::size_t full = 1;
+    while (full <= size + 1)
+        full <<= 1;
+    full >>= 1;
+    std::size_t leaves = size + 1 - full;
+    
+    compress_vine(&pseudo_root, leaves);
+    size -= leaves;
+    while (size > 1)
+    {
+        size /= 2;
+        compress_vine(&pseudo_root, size);
+    }
+    
+    root = pseudo_root.right;
+    
+    update_heights();
+}
+
+// unroll the tree hanging at the right of the pseudo root into a vine
+// precondition: valid pseudo root pointer is given
+// postcondition: every node has only a right child, return the number of nodes
+template <class T, class P>
+std::size_t AVLTree<T,P>::tree_to_vine(AVLNode<T>* pseudo_root)
+{
+    AVLNode<T>* tail = pseudo_root;
+    AVLNode<T>* rest = tail->right;
+    std::size_t size = 0;
+    
+    while (rest)
+    {
+        if (!rest->left)
+        {
+            // the node is already part of the vine
+            tail = rest;
+            rest = rest->right;
+            size++;
+        }
+        else
+        {
+            // rotate the left child up
+            AVLNode<T>* child = rest->left;
+            rest->left  = child->right;
+            child->right = rest;
+            rest        = child;
+            tail->right = child;
+        }
+    }
+    
+    return size;
+}
+
+// delete the tombstones of the vine hanging at the right of the pseudo root
+// precondition: valid pseudo root pointer is given
+// postcondition: no tombstone left in the vine, return the number of nodes
+// deleted
+template <class T, class P>
+std::size_t AVLTree<T,P>::purge_vine(AVLNode<T>* pseudo_root)
+{
+    AVLNode<T>* tail    = pseudo_root;
+    std::size_t deleted = 0;
+    
+    while (tail->right)
+    {
+        AVLNode<T>* node = tail->right;
+        if (get_count(node) == 0)
+        {
+            tail->right = node->right;
+            delete_node(node);
+            deleted++;
+        }
+        else
+            tail = node;
+    }
+    
+    tombstones = 0;
+    
+    return deleted;
+}
+
+// left rotation of every other node along the vine
+// precondition: valid pseudo root pointer, the vine has at least 2*count nodes
+// postcondition: count nodes of the vine moved down to the left
+template <class T, class P>
+void AVLTree<T,P>::compress_vine(AVLNode<T>* pseudo_root, std::size_t count)
+{
+    AVLNode<T>* scanner = pseudo_root;
+    
+    for (std::size_t k = 0; k < count; k++)
+    {
+        AVLNode<T>* child = scanner->right;
+        scanner->right = child->right;
+        scanner        = scanner->right;
+        child->right   = scanner->left;
+        scanner->left  = child;
+    }
+}
+
+// update heights and balances of all the nodes by a post-order traversal,
+// the stack grows with the height of the tree
+// precondition: none
+// postcondition: heights and balances are updated, no node is marked
+template <class T, class P>
+void AVLTree<T,P>::update_heights()
+{
+    std::vector<AVLNode<T>*> stack;
+    AVLNode<T>* node = root;
+    AVLNode<T>* last = nullptr;
+    
+    while (node || !stack.empty())
+    {
+        if (node)
+        {
+            stack.push_back(node);
+            node = node->left;
+        }
+        else if (stack.back()->right && stack.back()->right != last)
+            node = stack.back()->right;
+        else
+        {
+            // both subtrees are done
+            last = stack.back();
+            stack.pop_back();
+            update_height_node(last);
+            (void)compute_node_balance(last);
+            if constexpr (has_marks)
+                fields(last)->dirty = false;
+        }
+    }
+}
+
+// update the heights of the nodes of an unbalanced insertion or removal and
+// mark the nodes to be rebalanced. A node is marked when it is unbalanced or
+// when one of its children is marked, so the marked nodes form a subtree
+// containing the root and every unmarked node roots a balanced subtree
+// precondition: path from the root of the nodes affected by the operation
+// postcondition: heights updated, nodes marked, path emptied
+template <class T, class P>
+void AVLTree<T,P>::mark_path(std::vector<AVLNode<T>*>& path)
+{
+    AVLNode<T>* node     = nullptr;
+    while (!path.empty())
+    {
+        // get a node from the traversed path
+        node = path.back();
+        path.pop_back();
+        
+        int balance = compute_node_balance(node);
+        
+        update_height_node(node);
+        
+        if constexpr (has_marks)
+            fields(node)->dirty = (balance < -1) || (balance > 1) ||
+                                  node_marked(node->left) || node_marked(node->right);
+    }
+}
+
+// rebalance the marked nodes in post-order, so that a node is repaired when
+// both its subtrees are balanced. The traversal position is kept between calls
+// and survives unbalanced insertions, other modifications restart it from the
+// root. The heights are kept correct at all times.
+// precondition: none
+// postcondition: at most budget nodes repaired, return true if no marked
+// node is left
+template <class T, class P>
+bool AVLTree<T,P>::rebalance_pending(std::size_t budget)
+{
+    if ( !is_rebalance_pending() )
+    {
+        pending.clear();
+        return true;
+    }
+    
+    if ( pending.empty() || pending_modifications != modifications )
+    {
+        pending.clear();
+        pending.push_back(root);
+        pending_modifications = modifications;
+    }
+    
+    while (budget > 0 && !pending.empty())
+    {
+        AVLNode<T>* node = pending.back();
+        
+        // go down to the marked children first
+        if ( node_marked(node->left) )
+            pending.push_back(node->left);
+        else if ( node_marked(node->right) )
+            pending.push_back(node->right);
+        else
+        {
+            repair_node(pending);
+            budget--;
+            
+            // update the ancestors heights as long as they change
+            for (std::size_t level = pending.size(); level-- > 0; )
+            {
+                int height = pending[level]->height;
+                update_height_node(pending[level]);
+                if (pending[level]->height == height)
+                    break;
+            }
+        }
+    }
+    
+    return !is_rebalance_pending();
+}
+
+// repair a node whose subtrees are balanced. If the heights of the subtrees
+// differ by more than one, the node and its lower subtree are joined into the
+// higher subtree: the node goes down along the inner spine of the higher
+// subtree to the first node of about the height of the lower subtree, takes
+// its place and adopts it, then the spine is rebalanced as after an insertion.
+// precondition: path from the root to the node, both subtrees of the node balanced
+// postcondition: the subtree of the node is balanced and unmarked, the node
+// is removed from the path
+template <class T, class P>
+void AVLTree<T,P>::repair_node(std::vector<AVLNode<T>*>& path)
+{
+    AVLNode<T>* node   = path.back();
+    std::size_t top    = path.size() - 1;
+    AVLNode<T>* parent = top ? path[top - 1] : nullptr;
+    int left_height    = node_height(node->left);
+    int right_height   = node_height(node->right);
+    
+    if constexpr (has_marks)
+        fields(node)->dirty = false;
+    path.pop_back();
+    
+    if (left_height - right_height <= 1 && right_height - left_height <= 1)
+    {
+        (void)compute_node_balance(node);
+        update_height_node(node);
+        return;
+    }
+    
+    // the higher child takes the place of the node
+    AVLNode<T>* child = (left_height > right_height) ? node->left : node->right;
+    if (!parent)
+        root = child;
+    else if (parent->left == node)
+        parent->left  = child;
+    else
+        parent->right = child;
+    path.push_back(child);
+    
+    if (left_height > right_height)
+    {
+        // go down the right spine of the left subtree
+        AVLNode<T>* spine = child->right;
+        while (node_height(spine) > right_height + 1)
+        {
+            path.push_back(spine);
+            spine = spine->right;
+        }
+        path.back()->right = node;
+        node->left         = spine;
+    }
+    else
+    {
+        // go down the left spine of the right subtree
+        AVLNode<T>* spine = child->left;
+        while (node_height(spine) > left_height + 1)
+        {
+            path.push_back(spine);
+            spine = spine->left;
+        }
+        path.back()->left = node;
+        node->right       = spine;
+    }
+    
+    (void)compute_node_balance(node);
+    update_height_node(node);
+    
+    // the node grew the spine by one level as an insertion would
+    (void)rebalance_insertion(path, path.size(), top);
+    
+    path.resize(top);
 }
 
 // rebalance to right. Perform either a rotate right or a left-right rotation
 // precondition: valid node and parent pointers are given
 // postcondition: return the new node after the rotation
-template <class T>
-AVLNode<T>* AVLTree<T>::rebalance_to_right(AVLNode<T>* node, AVLNode<T>* parent)
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::rebalance_to_right(AVLNode<T>* node, AVLNode<T>* parent)
 {
     AVLNode<T>* new_node = nullptr;
     
@@ -633,7 +2831,10 @@ AVLNode<T>* AVLTree<T>::rebalance_to_right(AVLNode<T>* node, AVLNode<T>* parent)
     {
         // perform first left rotation of child node
         node->left = rotate_left(node->left);
+        AVLTREE_COUNT(rotation_left_right);
     }
+    else
+        AVLTREE_COUNT(rotation_right);
     
     new_node = rotate_right(node);
     
@@ -653,8 +2854,8 @@ AVLNode<T>* AVLTree<T>::rebalance_to_right(AVLNode<T>* node, AVLNode<T>* parent)
 // rebalance to left. Perform either a rotate left or a right-left rotation
 // precondition: valid node and parent pointers are given
 // postcondition: return the new node after the rotation
-template <class T>
-AVLNode<T>* AVLTree<T>::rebalance_to_left(AVLNode<T>* node, AVLNode<T>* parent)
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::rebalance_to_left(AVLNode<T>* node, AVLNode<T>* parent)
 {
     AVLNode<T>* new_node = nullptr;
     
@@ -666,7 +2867,10 @@ AVLNode<T>* AVLTree<T>::rebalance_to_left(AVLNode<T>* node, AVLNode<T>* parent)
     {
         // perform first right rotation of child node
         node->right = rotate_right(node->right);
+        AVLTREE_COUNT(rotation_right_left);
     }
+    else
+        AVLTREE_COUNT(rotation_left);
     
     new_node = rotate_left(node);
     
@@ -688,8 +2892,8 @@ AVLNode<T>* AVLTree<T>::rebalance_to_left(AVLNode<T>* node, AVLNode<T>* parent)
 // postcondition: return the new parent of the subtree where the right node of
 // the input node becomes the new parent and the input node becomes its new
 // left node
-template <class T>
-AVLNode<T>* AVLTree<T>::rotate_left(AVLNode<T>* node)
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::rotate_left(AVLNode<T>* node)
 {
     AVLNode<T>* new_left   = node;
     AVLNode<T>* new_parent = node->right;
@@ -714,8 +2918,8 @@ AVLNode<T>* AVLTree<T>::rotate_left(AVLNode<T>* node)
 // postcondition: return the new parent of the subtree where the left node of
 // the input node becomes the new parent and the input node becomes its new
 // right node
-template <class T>
-AVLNode<T>* AVLTree<T>::rotate_right(AVLNode<T>* node)
+template <class T, class P>
+AVLNode<T>* AVLTree<T,P>::rotate_right(AVLNode<T>* node)
 {
     AVLNode<T>* new_right  = node;
     AVLNode<T>* new_parent = node->left;
@@ -728,7 +2932,7 @@ AVLNode<T>* AVLTree<T>::rotate_right(AVLNode<T>* node)
     
     // update new right height
     update_height_node(new_right);
-        
+    
     // update new parent height
     update_height_node(new_parent);
     
@@ -736,4 +2940,9 @@ AVLNode<T>* AVLTree<T>::rotate_right(AVLNode<T>* node)
 }
 
 }
+
+// the read-only layouts need the complete AVLTree definition
+#include "FrozenAVLTree.h"
+#include "EytzingerIndex.h"
+
 #endif /* AVLTree_h */
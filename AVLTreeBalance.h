@@ -0,0 +1,85 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeBalance_h
+#define AVLTreeBalance_h
+
+namespace mathsophy
+{
+
+// Balancing policies of AVLTree. A policy tells whether the removals follow
+// the rank rules and checks the balancing rule at a node, given the height
+// fields of the node and of its children, 0 standing for a missing child.
+// It also lists the optional fields of the nodes, none for the policies
+// below, so that a tree pays only for the features it uses.
+
+// Optional fields of the nodes and the features needing them
+enum AVLNodeFeature : unsigned int
+{
+    // number of elements of the subtree: rank, select and size in O(1)
+    node_sizes      = 1,
+    // multiplicity of the key: multiset and lazy modes, needs node_sizes
+    node_counts     = 2,
+    // mark of the nodes waiting to be rebalanced: relaxed mode
+    node_marks      = 4,
+    // reference bit of the nodes found: evict_lru eviction policy
+    node_references = 8
+};
+
+// Classic AVL balancing: the height of a node is one more than the height of
+// its higher child and the heights of the children differ by at most one.
+// A removal may need a rotation at every level of the path.
+struct AVLBalance
+{
+    static constexpr bool         rank_balanced = false;
+    static constexpr unsigned int features      = 0;
+    static constexpr bool is_valid(int height, int left_height, int right_height)
+    {
+        return height == (left_height > right_height ? left_height : right_height) + 1 &&
+               left_height - right_height <= 1 && right_height - left_height <= 1;
+    }
+};
+
+// Weak AVL balancing (Haeupler, Sen and Tarjan, rank-balanced trees): the
+// height field holds the rank of the node plus one, the rank differences
+// between a node and its children are 1 or 2 and the leaves have rank 0.
+// Insertions are the same as in an AVL tree, so without removals the tree is
+// an AVL tree, while removals mostly demote nodes and need at most two
+// rotations. The height stays below 2 log2(n).
+struct WAVLBalance
+{
+    static constexpr bool         rank_balanced = true;
+    static constexpr unsigned int features      = 0;
+    static constexpr bool is_valid(int height, int left_height, int right_height)
+    {
+        return height - left_height >= 1 && height - left_height <= 2 &&
+               height - right_height >= 1 && height - right_height <= 2 &&
+               (left_height > 0 || right_height > 0 || height == 1);
+    }
+};
+
+// Balancing policy B with the optional node fields of the given features,
+// e.g. AVLFeatures<AVLBalance, node_sizes | node_counts> for a multiset
+// with order statistics
+template<class B, unsigned int F>
+struct AVLFeatures : B
+{
+    static constexpr unsigned int features = F;
+};
+
+}
+#endif /* AVLTreeBalance_h */
@@ -0,0 +1,235 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeExport_h
+#define AVLTreeExport_h
+
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// Export of the shape of a tree as a graphviz DOT graph or as nested JSON
+// objects, written to the stream node by node during a single traversal with
+// an explicit stack, so the memory taken is proportional to the height of the
+// tree and not to its size. Every node is exported with its key, height,
+// balance factor and, when the policy of the tree has node_sizes, subtree
+// size. The subtrees below the depth limit, or skipped by the sampling, are
+// replaced by a single summary node with their height and size, which keeps
+// the dump of a large tree small and readable. The keys are written with
+// operator<<.
+enum AVLExportFormat
+{
+    export_dot,
+    export_json
+};
+
+// options of the export
+struct AVLExportOptions
+{
+    // output format
+    AVLExportFormat format    = export_dot;
+    // levels exported below the root of the export, deeper subtrees summarized
+    std::size_t     max_depth = std::numeric_limits<std::size_t>::max();
+    // probability of expanding each subtree below the root, the others are
+    // summarized: about (2 sample)^d nodes are kept at depth d, and the same
+    // seed gives the same selection
+    double          sample    = 1.0;
+    std::uint64_t   seed      = 0;
+};
+
+// export the whole tree
+// precondition: no concurrent updates of the tree
+// postcondition: return true if the whole export was written to the stream
+template<class T, class P>
+bool export_tree(const AVLTree<T,P>& tree, std::ostream& out, const AVLExportOptions& options = AVLExportOptions());
+
+// export the subtree of the given node of the tree, e.g. found by AVLTree::find
+// precondition: no concurrent updates of the tree, the node belongs to it
+// postcondition: return true if the whole export was written to the stream
+template<class T, class P>
+bool export_tree(const AVLTree<T,P>& tree, const AVLNode<T>* root, std::ostream& out, const AVLExportOptions& options = AVLExportOptions());
+
+// write a key escaped for a DOT or JSON quoted string
+template<class T>
+void export_key(std::ostream& out, const T& key);
+
+template <class T, class P>
+bool export_tree(const AVLTree<T,P>& tree, std::ostream& out, const AVLExportOptions& options)
+{
+    return export_tree(tree, tree.get_root(), out, options);
+}
+
+template <class T, class P>
+bool export_tree(const AVLTree<T,P>&, const AVLNode<T>* root, std::ostream& out, const AVLExportOptions& options)
+{
+    // node being exported: its parent identifier in the DOT graph, its side
+    // and, for JSON, the next step of its object
+    struct Frame
+    {
+        const AVLNode<T>* node;
+        std::size_t       depth;
+        std::size_t       parent;
+        char              side;
+        int               stage;
+    };
+    
+    std::mt19937_64 gen(options.seed);
+    std::uniform_real_distribution<double> distr(0.0, 1.0);
+    bool dot = options.format == export_dot;
+    
+    // subtree sizes, kept by the nodes of the policies with node_sizes only
+    auto size = [&out](const AVLNode<T>* node, const char* separator)
+    {
+        if constexpr ((P::features & node_sizes) != 0)
+            out << separator << AVLTree<T,P>::get_size(node);
+    };
+    
+    // the summarized subtrees keep their height and size only
+    auto expand = [&](std::size_t depth)
+    {
+        if (depth > options.max_depth)
+            return false;
+        return depth == 0 || options.sample >= 1.0 || distr(gen) < options.sample;
+    };
+    
+    if (dot)
+        out << "digraph AVLTree {\n"
+            << "    node [shape=circle, fixedsize=true, width=0.75, height=0.75];\n";
+    
+    std::vector<Frame> stack;
+    if (root)
+        stack.push_back({ root, 0, 0, 0, 0 });
+    else if (!dot)
+        out << "null";
+    
+    std::size_t next = 0;
+    while ( !stack.empty() && out )
+    {
+        Frame& frame = stack.back();
+        const AVLNode<T>* node = frame.node;
+        
+        // DOT: one statement per node and per edge, in preorder
+        if (dot)
+        {
+            Frame current = frame;
+            stack.pop_back();
+            std::size_t id = next++;
+            
+            if ( expand(current.depth) )
+            {
+                out << "    n" << id << " [label=\"";
+                export_key(out, node->get_key());
+                out << "\\n(" << node->get_height() << "," << node->get_balance() << ")\"];\n";
+            }
+            else
+            {
+                out << "    n" << id << " [shape=box, style=dashed, fixedsize=false, label=\"height "
+                    << node->get_height();
+                size(node, "\\nsize ");
+                out << "\"];\n";
+                node = nullptr;
+            }
+            if (current.depth > 0)
+                out << "    n" << current.parent << " -> n" << id << " [label=\"" << current.side << "\"];\n";
+            
+            if (node)
+            {
+                // right pushed first so the left subtree is written first
+                if (node->get_right())
+                    stack.push_back({ node->get_right(), current.depth + 1, id, 'R', 0 });
+                if (node->get_left())
+                    stack.push_back({ node->get_left(), current.depth + 1, id, 'L', 0 });
+            }
+            continue;
+        }
+        
+        // JSON: the object of a node is opened, then its left and right
+        // members are written by the frames of the children, then it is closed
+        switch (frame.stage++)
+        {
+            case 0:
+                if ( !expand(frame.depth) )
+                {
+                    out << "{\"summary\":true,\"height\":" << node->get_height();
+                    size(node, ",\"size\":");
+                    out << "}";
+                    stack.pop_back();
+                    break;
+                }
+                out << "{\"key\":\"";
+                export_key(out, node->get_key());
+                out << "\",\"height\":" << node->get_height() << ",\"balance\":" << node->get_balance();
+                size(node, ",\"size\":");
+                out << ",\"left\":";
+                if (node->get_left())
+                    stack.push_back({ node->get_left(), frame.depth + 1, 0, 'L', 0 });
+                else
+                    out << "null";
+                break;
+            case 1:
+                out << ",\"right\":";
+                if (node->get_right())
+                    stack.push_back({ node->get_right(), frame.depth + 1, 0, 'R', 0 });
+                else
+                    out << "null";
+                break;
+            default:
+                out << "}";
+                stack.pop_back();
+                break;
+        }
+    }
+    
+    if (dot)
+        out << "}\n";
+    else
+        out << "\n";
+    
+    return static_cast<bool>(out);
+}
+
+template <class T>
+void export_key(std::ostream& out, const T& key)
+{
+    std::ostringstream text;
+    if constexpr (std::is_integral<T>::value && sizeof(T) == 1)
+        text << static_cast<int>(key);
+    else
+        text << key;
+    
+    for (char c : text.str())
+    {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c == '\n')
+            out << "\\n";
+        else if (static_cast<unsigned char>(c) >= 0x20)
+            out << c;
+    }
+}
+
+}
+#endif /* AVLTreeExport_h */
@@ -0,0 +1,347 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeHash_h
+#define AVLTreeHash_h
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+namespace mathsophy
+{
+
+template<class T>
+class AVLNode;
+
+// keys usable by the hash index
+template<class T>
+struct is_hashable : std::is_invocable_r<std::size_t, std::hash<T>, const T&> { };
+
+// Hash table from the keys to the nodes of a tree, with open addressing and
+// linear probing. The slots hold a copy of the key next to the node pointer,
+// so a lookup touches one cache line in most cases and the node only when
+// the key is found. Removals shift the following entries back instead of
+// leaving deleted markers. The table doubles when the number of entries
+// exceeds the maximum load factor of its capacity, a lower load factor
+// trading memory for shorter probe sequences.
+template<class T>
+class AVLHashIndex
+{
+public:
+    // constructor
+    AVLHashIndex() : entries(0), shift(64), max_load(0.5) { };
+    // node of a key, nullptr if the key is not indexed
+    AVLNode<T>* find(const T& key) const;
+    // add the node of a key not yet indexed
+    void        insert(const T& key, AVLNode<T>* node);
+    // remove the node of a key
+    void        erase(const T& key);
+    // replace the node of an indexed key
+    void        move(const T& key, AVLNode<T>* node);
+    // remove all the entries and free the table
+    void        clear() { slots.clear(); slots.shrink_to_fit(); entries = 0; shift = 64; };
+    // maximum load factor, a value outside ]0,1[ is rejected: 0 would grow
+    // the table forever and 1 would let it fill up with no empty slot left
+    // to end the probes
+    double      get_max_load() const { return max_load; };
+    bool        set_max_load(double load);
+    // number of entries and bytes taken by the table
+    std::size_t size() const { return entries; };
+    std::size_t memory() const { return slots.capacity() * sizeof(Slot); };
+private:
+    struct Slot
+    {
+        T           key;
+        AVLNode<T>* node;
+    };
+    // slot of a key before probing, from the top bits of a multiplicative hash
+    std::size_t home(const T& key) const
+    {
+        return static_cast<std::size_t>((std::uint64_t(std::hash<T>{}(key)) * 0x9E3779B97F4A7C15ull) >> shift);
+    };
+    void        grow();
+    std::vector<Slot> slots;
+    std::size_t       entries;
+    unsigned int      shift;
+    double            max_load;
+};
+
+// Direct-mapped cache from the keys found most often to their nodes, in front
+// of the tree traversal. Each slot holds a key, its node and a reference bit
+// set by every hit. A miss takes over its slot only if the bit is clear,
+// otherwise it clears the bit, as the hand of the CLOCK policy does: the
+// entry of a hot key survives the cold keys mapped to the same slot as long
+// as it is hit again before the second of them. The cache counts its hits and
+// misses since it was last resized.
+template<class T>
+class AVLHotCache
+{
+public:
+    // constructor
+    AVLHotCache() : shift(64), hits(0), misses(0) { };
+    // node of a cached key, nullptr on a miss
+    AVLNode<T>* find(const T& key);
+    // offer the node of a key found by the traversal after a miss
+    void        admit(const T& key, AVLNode<T>* node);
+    // drop the entry of a node
+    void        erase(const T& key, const AVLNode<T>* node);
+    // point the entry of a node to its copy
+    void        move(const T& key, const AVLNode<T>* node, AVLNode<T>* copy);
+    // drop all the entries and set the number of slots, rounded up to a
+    // power of two of at least 2, 0 frees the cache
+    void        resize(std::size_t capacity);
+    // number of slots, bytes taken and counters
+    std::size_t   capacity() const { return slots.size(); };
+    std::size_t   memory() const { return slots.capacity() * sizeof(Slot); };
+    std::uint64_t get_hits() const { return hits; };
+    std::uint64_t get_misses() const { return misses; };
+private:
+    struct Slot
+    {
+        T           key;
+        AVLNode<T>* node;
+        bool        referenced;
+    };
+    // slot of a key, from the top bits of a multiplicative hash
+    std::size_t home(const T& key) const
+    {
+        return static_cast<std::size_t>((std::uint64_t(std::hash<T>{}(key)) * 0x9E3779B97F4A7C15ull) >> shift);
+    };
+    std::vector<Slot> slots;
+    unsigned int      shift;
+    std::uint64_t     hits;
+    std::uint64_t     misses;
+};
+
+// set the maximum load factor
+// precondition: none
+// postcondition: return false and keep the former load factor if the given
+// one is not in ]0,1[, otherwise return true
+template <class T>
+bool AVLHashIndex<T>::set_max_load(double load)
+{
+    if ( !(load > 0.0 && load < 1.0) )
+        return false;
+    
+    max_load = load;
+    return true;
+}
+
+// find the node of a key
+// precondition: none
+// postcondition: return the node of the key, nullptr if not indexed
+template <class T>
+AVLNode<T>* AVLHashIndex<T>::find(const T& key) const
+{
+    if (entries == 0)
+        return nullptr;
+    
+    std::size_t mask = slots.size() - 1;
+    for (std::size_t k = home(key); ; k = (k + 1) & mask)
+    {
+        const Slot& slot = slots[k];
+        if (!slot.node)
+            return nullptr;
+        if (!(slot.key < key) && !(key < slot.key))
+            return slot.node;
+    }
+}
+
+// add an entry
+// precondition: the key is not indexed yet
+// postcondition: entry added, the table grown if needed
+template <class T>
+void AVLHashIndex<T>::insert(const T& key, AVLNode<T>* node)
+{
+    if (entries + 1 > max_load * slots.size())
+        grow();
+    
+    std::size_t mask = slots.size() - 1;
+    std::size_t k    = home(key);
+    while (slots[k].node)
+        k = (k + 1) & mask;
+    
+    slots[k] = { key, node };
+    entries++;
+}
+
+// point an entry to another node
+// precondition: none
+// postcondition: the key is indexed with the given node if it was indexed
+template <class T>
+void AVLHashIndex<T>::move(const T& key, AVLNode<T>* node)
+{
+    if (entries == 0)
+        return;
+    
+    std::size_t mask = slots.size() - 1;
+    for (std::size_t k = home(key); slots[k].node; k = (k + 1) & mask)
+        if (!(slots[k].key < key) && !(key < slots[k].key))
+        {
+            slots[k].node = node;
+            return;
+        }
+}
+
+// remove an entry. The entries following it in the probe sequence move back
+// to the freed slot unless their home slot lies between the two slots
+// precondition: none
+// postcondition: the key is not indexed anymore
+template <class T>
+void AVLHashIndex<T>::erase(const T& key)
+{
+    if (entries == 0)
+        return;
+    
+    std::size_t mask = slots.size() - 1;
+    std::size_t free = home(key);
+    while (true)
+    {
+        if (!slots[free].node)
+            return;
+        if (!(slots[free].key < key) && !(key < slots[free].key))
+            break;
+        free = (free + 1) & mask;
+    }
+    
+    for (std::size_t k = (free + 1) & mask; slots[k].node; k = (k + 1) & mask)
+    {
+        // distances from the home slot of the entry
+        std::size_t distance = (k - home(slots[k].key)) & mask;
+        if (distance >= ((k - free) & mask))
+        {
+            slots[free] = slots[k];
+            free        = k;
+        }
+    }
+    
+    slots[free].node = nullptr;
+    entries--;
+}
+
+// double the capacity and insert the entries again
+// precondition: none
+// postcondition: capacity enough for one more entry within the load factor
+template <class T>
+void AVLHashIndex<T>::grow()
+{
+    std::vector<Slot> old;
+    old.swap(slots);
+    
+    std::size_t capacity = old.empty() ? 16 : 2 * old.size();
+    while (entries + 1 > max_load * capacity)
+        capacity *= 2;
+    
+    slots.assign(capacity, Slot{ T{}, nullptr });
+    shift = 64;
+    for (std::size_t size = capacity; size > 1; size >>= 1)
+        shift--;
+    entries = 0;
+    
+    for (const Slot& slot : old)
+        if (slot.node)
+            insert(slot.key, slot.node);
+}
+
+// look up a key in its slot
+// precondition: none
+// postcondition: return the cached node of the key, nullptr on a miss
+template <class T>
+AVLNode<T>* AVLHotCache<T>::find(const T& key)
+{
+    if (slots.empty())
+        return nullptr;
+    
+    Slot& slot = slots[home(key)];
+    if (slot.node && !(slot.key < key) && !(key < slot.key))
+    {
+        hits++;
+        slot.referenced = true;
+        return slot.node;
+    }
+    
+    misses++;
+    return nullptr;
+}
+
+// cache a node unless its slot holds an entry hit since the last miss
+// precondition: the node holds the key
+// postcondition: node cached or reference bit of the slot cleared
+template <class T>
+void AVLHotCache<T>::admit(const T& key, AVLNode<T>* node)
+{
+    if (slots.empty())
+        return;
+    
+    Slot& slot = slots[home(key)];
+    if (slot.node && slot.referenced)
+        slot.referenced = false;
+    else
+        slot = { key, node, false };
+}
+
+// remove the entry of a node about to be freed
+// precondition: the node holds the key
+// postcondition: the node is not cached
+template <class T>
+void AVLHotCache<T>::erase(const T& key, const AVLNode<T>* node)
+{
+    if (slots.empty())
+        return;
+    
+    Slot& slot = slots[home(key)];
+    if (slot.node == node)
+        slot = { T{}, nullptr, false };
+}
+
+// follow a node moved to another address
+// precondition: the node holds the key
+// postcondition: the copy is cached in place of the node if it was cached
+template <class T>
+void AVLHotCache<T>::move(const T& key, const AVLNode<T>* node, AVLNode<T>* copy)
+{
+    if (slots.empty())
+        return;
+    
+    Slot& slot = slots[home(key)];
+    if (slot.node == node)
+        slot.node = copy;
+}
+
+// allocate the slots and reset the counters
+// precondition: none
+// postcondition: empty cache of at least the given number of slots
+template <class T>
+void AVLHotCache<T>::resize(std::size_t capacity)
+{
+    // two slots at least, the shift of the hash staying below 64
+    std::size_t size = 0;
+    shift = 63;
+    if (capacity > 0)
+        for (size = 2; size < capacity; size <<= 1)
+            shift--;
+    
+    std::vector<Slot>(size, Slot{ T{}, nullptr, false }).swap(slots);
+    hits   = 0;
+    misses = 0;
+}
+
+}
+#endif /* AVLTreeHash_h */
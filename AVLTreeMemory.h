@@ -0,0 +1,73 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeMemory_h
+#define AVLTreeMemory_h
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+namespace mathsophy
+{
+
+// Memory accounting of the trees. Every allocation is charged with the size
+// of the chunk the heap actually reserves for it: the request plus a header
+// word, rounded up to a multiple of two words, with a minimum of four words,
+// as the chunks of the glibc and of most dlmalloc-derived allocators. The
+// keys are charged with the heap storage they own outside of the node, which
+// key_heap_bytes returns: nothing for the keys stored in place, the buffer of
+// the strings too long for the short string optimization. Overloads of
+// key_heap_bytes in the namespace of a key type extend the accounting to it.
+enum AVLEvictionPolicy
+{
+    // evict the smallest keys, keeping the largest ones
+    evict_smallest,
+    // evict the largest keys, keeping the smallest ones
+    evict_largest,
+    // evict the keys found least recently, approximated by the CLOCK policy
+    evict_lru
+};
+
+// bytes reserved by the heap for an allocation of the given size
+inline constexpr std::size_t allocation_size(std::size_t bytes)
+{
+    constexpr std::size_t word    = sizeof(std::size_t);
+    std::size_t           chunk   = (bytes + word + 2 * word - 1) & ~(2 * word - 1);
+    return bytes == 0 ? 0 : (chunk < 4 * word ? 4 * word : chunk);
+}
+
+// heap bytes owned by a key outside of its node
+template<class T>
+std::size_t key_heap_bytes(const T&)
+{
+    return 0;
+}
+
+inline std::size_t key_heap_bytes(const std::string& key)
+{
+    // the characters of a short string are stored inside the object
+    std::less<const char*> before;
+    const char* data   = key.data();
+    const char* object = reinterpret_cast<const char*>(&key);
+    if (!before(data, object) && before(data, object + sizeof(std::string)))
+        return 0;
+    return allocation_size(key.capacity() + 1);
+}
+
+}
+#endif /* AVLTreeMemory_h */
@@ -0,0 +1,248 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeStats_h
+#define AVLTreeStats_h
+
+#include <cstdint>
+#include <cstddef>
+
+// The operation counters are compiled in only when AVLTREE_STATS is defined.
+// With AVLTREE_STATS_PER_THREAD every thread counts into its own block of
+// relaxed atomic counters, the blocks are summed up by the snapshot.
+#if defined(AVLTREE_STATS_PER_THREAD) && !defined(AVLTREE_STATS)
+#define AVLTREE_STATS
+#endif
+
+#ifdef AVLTREE_STATS
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
+
+namespace mathsophy
+{
+
+// Snapshot of the operation counters of a tree. The histograms count the
+// operations by number of levels, the last bin collects the longer ones.
+struct AVLTreeStats
+{
+    static constexpr std::size_t histogram_size = 48;
+    // rotations by type
+    std::uint64_t rotations_left;
+    std::uint64_t rotations_right;
+    std::uint64_t rotations_left_right;
+    std::uint64_t rotations_right_left;
+    // nodes traversed by insertions and removals
+    std::uint64_t path_length[histogram_size];
+    // levels climbed by the rebalancing up to the last change
+    std::uint64_t rebalance_depth[histogram_size];
+    // subtrees reinserted by removals of nodes with two children
+    std::uint64_t sibling_reinsertions;
+    // node allocations and frees
+    std::uint64_t allocations;
+    std::uint64_t frees;
+};
+
+#ifdef AVLTREE_STATS
+
+// Operation counters of a tree
+class AVLTreeCounters
+{
+public:
+    // counter indices, the histograms take histogram_size counters each
+    enum Counter
+    {
+        rotation_left,
+        rotation_right,
+        rotation_left_right,
+        rotation_right_left,
+        sibling_reinsertion,
+        node_allocation,
+        node_free,
+        path_length,
+        rebalance_depth = path_length + AVLTreeStats::histogram_size,
+        number_counters = rebalance_depth + AVLTreeStats::histogram_size
+    };
+    // constructor
+    AVLTreeCounters() { reset(); };
+    AVLTreeCounters(const AVLTreeCounters&) : AVLTreeCounters() { };
+    AVLTreeCounters& operator=(const AVLTreeCounters&) { return *this; };
+    // count an event
+    void        add(std::size_t counter, std::uint64_t value = 1);
+    // count a histogram sample
+    void        sample(std::size_t histogram, std::size_t levels);
+    // sum of the counters
+    AVLTreeStats snapshot() const;
+    // set all the counters to zero
+    void        reset();
+private:
+#ifdef AVLTREE_STATS_PER_THREAD
+    // counters of a thread, updated only by the owning thread, a thread
+    // given the identifier of an ended one taking over its block
+    struct Block
+    {
+        Block(std::thread::id thread) : owner(thread) { for (std::atomic<std::uint64_t>& value : values) value.store(0, std::memory_order_relaxed); };
+        std::thread::id            owner;
+        std::atomic<std::uint64_t> values[number_counters];
+    };
+    // sets and ways of the cache of each thread from the counters to its blocks
+    static constexpr std::size_t cache_sets = 4;
+    static constexpr std::size_t cache_ways = 4;
+    Block&      local();
+    // registry of the blocks of the threads using the tree, the identifier
+    // of the counters is never reused so that stale cache entries never match
+    static std::uint64_t next_id() { static std::atomic<std::uint64_t> id(0); return ++id; };
+    mutable std::mutex                  mutex;
+    std::vector<std::unique_ptr<Block>> blocks;
+    std::uint64_t                       id = next_id();
+#else
+    std::uint64_t values[number_counters];
+#endif
+};
+
+// add a value to a counter
+// precondition: valid counter index
+// postcondition: counter incremented
+inline void AVLTreeCounters::add(std::size_t counter, std::uint64_t value)
+{
+#ifdef AVLTREE_STATS_PER_THREAD
+    local().values[counter].fetch_add(value, std::memory_order_relaxed);
+#else
+    values[counter] += value;
+#endif
+}
+
+// add a sample to a histogram
+// precondition: valid histogram index
+// postcondition: bin of the given levels incremented
+inline void AVLTreeCounters::sample(std::size_t histogram, std::size_t levels)
+{
+    if (levels >= AVLTreeStats::histogram_size)
+        levels = AVLTreeStats::histogram_size - 1;
+    add(histogram + levels);
+}
+
+// snapshot of the counters
+// precondition: none
+// postcondition: return the counters summed over all threads
+inline AVLTreeStats AVLTreeCounters::snapshot() const
+{
+    std::uint64_t sum[number_counters] = {};
+
+#ifdef AVLTREE_STATS_PER_THREAD
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<Block>& block : blocks)
+        for (std::size_t k = 0; k < number_counters; k++)
+            sum[k] += block->values[k].load(std::memory_order_relaxed);
+#else
+    for (std::size_t k = 0; k < number_counters; k++)
+        sum[k] = values[k];
+#endif
+    
+    AVLTreeStats stats;
+    stats.rotations_left       = sum[rotation_left];
+    stats.rotations_right      = sum[rotation_right];
+    stats.rotations_left_right = sum[rotation_left_right];
+    stats.rotations_right_left = sum[rotation_right_left];
+    stats.sibling_reinsertions = sum[sibling_reinsertion];
+    stats.allocations          = sum[node_allocation];
+    stats.frees                = sum[node_free];
+    for (std::size_t k = 0; k < AVLTreeStats::histogram_size; k++)
+    {
+        stats.path_length[k]     = sum[path_length + k];
+        stats.rebalance_depth[k] = sum[rebalance_depth + k];
+    }
+    
+    return stats;
+}
+
+// reset the counters
+// precondition: none
+// postcondition: all counters set to zero
+inline void AVLTreeCounters::reset()
+{
+#ifdef AVLTREE_STATS_PER_THREAD
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const std::unique_ptr<Block>& block : blocks)
+        for (std::atomic<std::uint64_t>& value : block->values)
+            value.store(0, std::memory_order_relaxed);
+#else
+    for (std::uint64_t& value : values)
+        value = 0;
+#endif
+}
+
+#ifdef AVLTREE_STATS_PER_THREAD
+// block of the calling thread, registered on first use. Each thread caches
+// its blocks in a few sets of ways selected by the identifier of the
+// counters, the most recently used way first, so that the trees used in turn
+// by a thread share a set without evicting each other. A miss looks up the
+// block of the thread in the registry and replaces the least recently used
+// way of the set, so the cache keeps a fixed size whatever the number of
+// trees the thread has used
+// precondition: none
+// postcondition: return the counters of the calling thread
+inline AVLTreeCounters::Block& AVLTreeCounters::local()
+{
+    thread_local std::pair<std::uint64_t, Block*> cache[cache_sets][cache_ways] = {};
+    
+    std::pair<std::uint64_t, Block*>* set = cache[id % cache_sets];
+    for (std::size_t way = 0; way < cache_ways; way++)
+        if (set[way].first == id)
+        {
+            std::rotate(set, set + way, set + way + 1);
+            return *set[0].second;
+        }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    std::thread::id self = std::this_thread::get_id();
+    Block* block = nullptr;
+    for (const std::unique_ptr<Block>& candidate : blocks)
+        if (candidate->owner == self)
+        {
+            block = candidate.get();
+            break;
+        }
+    
+    if (!block)
+    {
+        blocks.push_back(std::unique_ptr<Block>(new Block(self)));
+        block = blocks.back().get();
+    }
+    std::rotate(set, set + cache_ways - 1, set + cache_ways);
+    set[0] = { id, block };
+    
+    return *block;
+}
+#endif
+
+#define AVLTREE_COUNT(counter)                 counters.add(AVLTreeCounters::counter)
+#define AVLTREE_SAMPLE(histogram, levels)      counters.sample(AVLTreeCounters::histogram, levels)
+
+#else
+
+#define AVLTREE_COUNT(counter)                 ((void)0)
+#define AVLTREE_SAMPLE(histogram, levels)      ((void)0)
+
+#endif /* AVLTREE_STATS */
+
+}
+#endif /* AVLTreeStats_h */
@@ -0,0 +1,222 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef AVLTreeTrace_h
+#define AVLTreeTrace_h
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+namespace mathsophy
+{
+
+// Binary trace of the operations on a tree. The file starts with a header
+// made of the 8 byte magic "AVLTRACE", a 32 bit format version and the 32 bit
+// key size, followed by one record per operation: the operation code byte
+// and the bytes of the key, in the byte order of the recording machine.
+enum AVLTraceOperation : std::uint8_t
+{
+    trace_insert = 1,
+    trace_remove = 2,
+    trace_find   = 3
+};
+
+// operation read back from a trace
+template<class T>
+struct AVLTraceRecord
+{
+    AVLTraceOperation operation;
+    T                 key;
+};
+
+// Writer of a trace, the records are buffered and written in blocks. A
+// failed write, e.g. on a full disk, is remembered and reported by flush and
+// close, the trace on disk being incomplete
+template<class T>
+class AVLTraceRecorder
+{
+    static_assert(std::is_trivially_copyable<T>::value, "AVLTraceRecorder requires trivially copyable keys");
+public:
+    // constructor
+    AVLTraceRecorder() : file(nullptr), records(0), failed(false) { };
+    AVLTraceRecorder(const AVLTraceRecorder<T>&) = delete;
+    AVLTraceRecorder<T>& operator=(const AVLTraceRecorder<T>&) = delete;
+    // destructor
+    ~AVLTraceRecorder() { close(); };
+    // start a new trace file, return false if the file cannot be written
+    bool        open(const std::string& file_name);
+    // flush the buffered records and close the file, return false if a
+    // record could not be written since the trace was opened
+    bool        close();
+    bool        is_open() const { return file != nullptr; };
+    // append an operation to the trace
+    void        record(AVLTraceOperation operation, const T& key);
+    // write the buffered records to the file, return false if a record could
+    // not be written since the trace was opened
+    bool        flush();
+    // number of recorded operations
+    std::size_t size() const { return records; };
+private:
+    static constexpr std::size_t record_size = 1 + sizeof(T);
+    static constexpr std::size_t buffer_size = 4096 * record_size;
+    std::FILE*        file;
+    std::vector<char> buffer;
+    std::size_t       records;
+    // a write has failed
+    bool              failed;
+};
+
+// read a whole trace into memory
+// precondition: none
+// postcondition: return false if the file cannot be read or was recorded
+// with another key size, otherwise the records are appended in order
+template<class T>
+bool read_trace(const std::string& file_name, std::vector<AVLTraceRecord<T>>& trace);
+
+// header of the trace files
+inline constexpr char          trace_magic[8] = { 'A', 'V', 'L', 'T', 'R', 'A', 'C', 'E' };
+inline constexpr std::uint32_t trace_version  = 1;
+
+// create the trace file and write the header
+// precondition: none
+// postcondition: return true if the file is open for recording
+template <class T>
+bool AVLTraceRecorder<T>::open(const std::string& file_name)
+{
+    close();
+    
+    file = std::fopen(file_name.c_str(), "wb");
+    if (!file)
+        return false;
+    
+    std::uint32_t header[2] = { trace_version, static_cast<std::uint32_t>(sizeof(T)) };
+    if (std::fwrite(trace_magic, sizeof(trace_magic), 1, file) != 1 ||
+        std::fwrite(header, sizeof(header), 1, file) != 1)
+    {
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+    
+    buffer.reserve(buffer_size);
+    records = 0;
+    failed  = false;
+    
+    return true;
+}
+
+// close the trace file
+// precondition: none
+// postcondition: file closed, return true if all the records were written
+// or if no file was open
+template <class T>
+bool AVLTraceRecorder<T>::close()
+{
+    if (!file)
+        return !failed;
+    
+    (void)flush();
+    if (std::fclose(file) != 0)
+        failed = true;
+    file = nullptr;
+    
+    return !failed;
+}
+
+// append a record to the buffer
+// precondition: none
+// postcondition: record buffered if the recorder is open, ignored otherwise
+template <class T>
+void AVLTraceRecorder<T>::record(AVLTraceOperation operation, const T& key)
+{
+    if (!file)
+        return;
+    
+    std::size_t size = buffer.size();
+    buffer.resize(size + record_size);
+    buffer[size] = static_cast<char>(operation);
+    std::memcpy(buffer.data() + size + 1, &key, sizeof(T));
+    records++;
+    
+    if (buffer.size() >= buffer_size)
+        (void)flush();
+}
+
+// write the buffered records and flush the stream, the records being
+// dropped once a write has failed
+// precondition: none
+// postcondition: buffer empty, return false if a write has failed
+template <class T>
+bool AVLTraceRecorder<T>::flush()
+{
+    if (file && !failed)
+        if ( (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size()) ||
+             std::fflush(file) != 0 )
+            failed = true;
+    buffer.clear();
+    
+    return !failed;
+}
+
+template <class T>
+bool read_trace(const std::string& file_name, std::vector<AVLTraceRecord<T>>& trace)
+{
+    std::FILE* file = std::fopen(file_name.c_str(), "rb");
+    if (!file)
+        return false;
+    
+    char magic[sizeof(trace_magic)];
+    std::uint32_t header[2];
+    if (std::fread(magic, sizeof(magic), 1, file) != 1 || std::memcmp(magic, trace_magic, sizeof(magic)) != 0 ||
+        std::fread(header, sizeof(header), 1, file) != 1 ||
+        header[0] != trace_version || header[1] != sizeof(T))
+    {
+        std::fclose(file);
+        return false;
+    }
+    
+    // decode the records block by block
+    std::vector<char> block(4096 * (1 + sizeof(T)));
+    std::size_t pending = 0;
+    std::size_t count   = 0;
+    while ((count = std::fread(block.data() + pending, 1, block.size() - pending, file)) > 0)
+    {
+        std::size_t size = pending + count;
+        std::size_t k    = 0;
+        for (; k + 1 + sizeof(T) <= size; k += 1 + sizeof(T))
+        {
+            AVLTraceRecord<T> record;
+            record.operation = static_cast<AVLTraceOperation>(block[k]);
+            std::memcpy(&record.key, block.data() + k + 1, sizeof(T));
+            trace.push_back(record);
+        }
+        // keep an incomplete record for the next block
+        pending = size - k;
+        std::memmove(block.data(), block.data() + k, pending);
+    }
+    
+    std::fclose(file);
+    
+    return pending == 0;
+}
+
+}
+#endif /* AVLTreeTrace_h */
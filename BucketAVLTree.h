@@ -0,0 +1,383 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BucketAVLTree_h
+#define BucketAVLTree_h
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include "AVLTree.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace mathsophy
+{
+
+// Sorted bucket of up to B keys. Buckets are ordered by their smallest key,
+// the unused slots of integral buckets hold the largest key value so that
+// they never compare smaller than a searched key.
+template<class T, std::size_t B>
+class AVLBucket
+{
+public:
+    // constructor
+    AVLBucket() : count(0) { std::fill(keys, keys + B, padding()); };
+    // ordering of the buckets by their smallest key
+    bool operator<(const AVLBucket<T,B>& bucket) const { return keys[0] < bucket.keys[0]; };
+    bool operator>(const AVLBucket<T,B>& bucket) const { return bucket.keys[0] < keys[0]; };
+    // value of the unused slots
+    static T padding() { return std::numeric_limits<T>::is_specialized ? std::numeric_limits<T>::max() : T{}; };
+    // number of keys smaller than the given key
+    std::size_t rank(const T& key) const;
+    // insert or erase the key at the given position
+    void        insert(std::size_t position, const T& key);
+    void        erase(std::size_t position);
+    std::uint32_t count;
+    T             keys[B];
+};
+
+// AVL tree of sorted buckets of keys. Every node holds a bucket of up to B keys
+// whose range does not overlap with the other buckets, so a tree of n keys
+// has about n/B nodes and log2(B) less levels than an AVLTree, and the per
+// node overhead is shared by the keys of the bucket. Full buckets are split
+// into two nodes, buckets falling under a quarter of their capacity are
+// merged with a neighbour. The balancing of the nodes is the AVL balancing
+// of AVLTree.
+template<class T, std::size_t B = 32>
+class BucketAVLTree : protected AVLTree<AVLBucket<T,B>>
+{
+    static_assert(B >= 4, "BucketAVLTree requires buckets of at least 4 keys");
+public:
+    // constructor
+    BucketAVLTree() : number_keys(0) { };
+    // balanced insertion of a new element
+    void        insert(T key);
+    // find an element
+    const T*    find(T key) const;
+    // balanced removal of an element
+    void        remove(T key);
+    // number of elements
+    std::size_t size() const { return number_keys; };
+    // test for balanced tree
+    using AVLTree<AVLBucket<T,B>>::is_balanced;
+    using AVLTree<AVLBucket<T,B>>::is_not_balanced;
+    // test for empty tree
+    using AVLTree<AVLBucket<T,B>>::is_empty;
+    using AVLTree<AVLBucket<T,B>>::is_not_empty;
+    // nodes of the tree, one per bucket
+    using AVLTree<AVLBucket<T,B>>::get_root;
+private:
+    typedef AVLTree<AVLBucket<T,B>> Base;
+    typedef AVLNode<AVLBucket<T,B>> Node;
+    // private helper functions
+    Node*       floor_node(const T& key) const;
+    Node*       next_node(const T& key) const;
+    Node*       previous_node(const T& key) const;
+    void        remove_node(const T& smallest_key);
+    std::size_t number_keys;
+};
+
+// number of keys smaller than the given key, with SIMD compares on the
+// whole bucket for 32 bit integral keys
+// precondition: none
+// postcondition: return the insertion position of the key
+template <class T, std::size_t B>
+std::size_t AVLBucket<T,B>::rank(const T& key) const
+{
+#if defined(__AVX2__)
+    if constexpr (std::is_integral<T>::value && sizeof(T) == 4 && B % 8 == 0)
+    {
+        // unsigned keys are compared as signed after flipping the sign bit
+        const __m256i flip = _mm256_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m256i x    = _mm256_xor_si256(_mm256_set1_epi32(int(key)), flip);
+        std::size_t less   = 0;
+        for (std::size_t k = 0; k < B; k += 8)
+        {
+            __m256i v = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + k)), flip);
+            less += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(x, v))));
+        }
+        return less;
+    }
+#elif defined(__SSE2__)
+    if constexpr (std::is_integral<T>::value && sizeof(T) == 4 && B % 4 == 0)
+    {
+        // unsigned keys are compared as signed after flipping the sign bit
+        const __m128i flip = _mm_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m128i x    = _mm_xor_si128(_mm_set1_epi32(int(key)), flip);
+        std::size_t less   = 0;
+        for (std::size_t k = 0; k < B; k += 4)
+        {
+            __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + k)), flip);
+            less += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x, v))));
+        }
+        return less;
+    }
+#endif
+    return std::lower_bound(keys, keys + count, key) - keys;
+}
+
+// insert a key into the bucket
+// precondition: bucket not full, position keeps the keys sorted
+// postcondition: key stored at the given position
+template <class T, std::size_t B>
+void AVLBucket<T,B>::insert(std::size_t position, const T& key)
+{
+    std::move_backward(keys + position, keys + count, keys + count + 1);
+    keys[position] = key;
+    count++;
+}
+
+// erase a key from the bucket
+// precondition: valid position
+// postcondition: key at the given position removed, the freed slot padded
+template <class T, std::size_t B>
+void AVLBucket<T,B>::erase(std::size_t position)
+{
+    std::move(keys + position + 1, keys + count, keys + position);
+    count--;
+    keys[count] = padding();
+}
+
+// insert a new key into the bucket covering it
+// precondition: none
+// postcondition: key inserted, a full bucket is split into two nodes
+// and the tree is kept balanced
+template <class T, std::size_t B>
+void BucketAVLTree<T,B>::insert(T key)
+{
+    Node* node = floor_node(key);
+    
+    // keys smaller than all the others go to the leftmost bucket
+    if (!node)
+    {
+        node = get_root();
+        while (node && node->get_left())
+            node = node->get_left();
+    }
+    
+    // first key of the tree
+    if (!node)
+    {
+        AVLBucket<T,B> bucket;
+        bucket.insert(0, key);
+        Base::insert(bucket);
+        number_keys++;
+        return;
+    }
+    
+    AVLBucket<T,B>& bucket = Base::node_key(node);
+    std::size_t position   = bucket.rank(key);
+    
+    // key already present!
+    if (position < bucket.count && !(key < bucket.keys[position]))
+        return;
+    
+    if (bucket.count < B)
+        bucket.insert(position, key);
+    else
+    {
+        // split the bucket, the upper half goes to a new node
+        AVLBucket<T,B> upper;
+        std::copy(bucket.keys + B / 2, bucket.keys + B, upper.keys);
+        std::fill(bucket.keys + B / 2, bucket.keys + B, AVLBucket<T,B>::padding());
+        upper.count  = B - B / 2;
+        bucket.count = B / 2;
+        
+        if (position > B / 2)
+            upper.insert(position - B / 2, key);
+        else
+            bucket.insert(position, key);
+        
+        Base::insert(upper);
+    }
+    
+    number_keys++;
+}
+
+// find a key in the tree
+// precondition: none
+// postcondition: return the pointer to the key if the key is found,
+// otherwise return a nullptr if the key is not found
+template <class T, std::size_t B>
+const T* BucketAVLTree<T,B>::find(T key) const
+{
+    Node* node = floor_node(key);
+    if (!node)
+        return nullptr;
+    
+    const AVLBucket<T,B>& bucket = Base::node_key(node);
+    std::size_t position         = bucket.rank(key);
+    
+    if (position < bucket.count && !(key < bucket.keys[position]))
+        return bucket.keys + position;
+    
+    return nullptr;
+}
+
+// remove a key from the bucket covering it
+// precondition: none
+// postcondition: key removed, an empty bucket is removed from the tree
+// and a bucket under a quarter of its capacity is merged with a neighbour
+template <class T, std::size_t B>
+void BucketAVLTree<T,B>::remove(T key)
+{
+    Node* node = floor_node(key);
+    if (!node)
+        return;
+    
+    AVLBucket<T,B>& bucket = Base::node_key(node);
+    std::size_t position   = bucket.rank(key);
+    
+    // key not present!
+    if (position == bucket.count || key < bucket.keys[position])
+        return;
+    
+    number_keys--;
+    
+    if (bucket.count == 1)
+    {
+        remove_node(key);
+        return;
+    }
+    
+    bucket.erase(position);
+    
+    if (bucket.count >= B / 4)
+        return;
+    
+    // merge with the next bucket if both fit into one
+    Node* next = next_node(bucket.keys[bucket.count - 1]);
+    if (next && bucket.count + Base::node_key(next).count <= B)
+    {
+        AVLBucket<T,B>& next_bucket = Base::node_key(next);
+        std::copy(next_bucket.keys, next_bucket.keys + next_bucket.count, bucket.keys + bucket.count);
+        bucket.count += next_bucket.count;
+        remove_node(next_bucket.keys[0]);
+        return;
+    }
+    
+    // otherwise merge into the previous bucket
+    Node* previous = previous_node(bucket.keys[0]);
+    if (previous && Base::node_key(previous).count + bucket.count <= B)
+    {
+        AVLBucket<T,B>& previous_bucket = Base::node_key(previous);
+        std::copy(bucket.keys, bucket.keys + bucket.count, previous_bucket.keys + previous_bucket.count);
+        previous_bucket.count += bucket.count;
+        remove_node(bucket.keys[0]);
+    }
+}
+
+// find the bucket covering a key, i.e. the bucket with the greatest
+// smallest key not greater than the key
+// precondition: none
+// postcondition: return the node of the bucket, nullptr if the key is
+// smaller than all the keys of the tree
+template <class T, std::size_t B>
+typename BucketAVLTree<T,B>::Node* BucketAVLTree<T,B>::floor_node(const T& key) const
+{
+    Node* node  = get_root();
+    Node* floor = nullptr;
+    
+    // tree traversal
+    while (node)
+    {
+        const AVLBucket<T,B>& bucket = Base::node_key(node);
+        if (key < bucket.keys[0])
+            node = node->get_left();
+        else
+        {
+            floor = node;
+            // key within the bucket range
+            if (!(bucket.keys[bucket.count - 1] < key))
+                break;
+            node = node->get_right();
+        }
+    }
+    
+    return floor;
+}
+
+// find the bucket following the given key
+// precondition: none
+// postcondition: return the node of the bucket with the smallest
+// smallest key greater than the key, nullptr if there is none
+template <class T, std::size_t B>
+typename BucketAVLTree<T,B>::Node* BucketAVLTree<T,B>::next_node(const T& key) const
+{
+    Node* node = get_root();
+    Node* next = nullptr;
+    
+    while (node)
+    {
+        if (key < Base::node_key(node).keys[0])
+        {
+            next = node;
+            node = node->get_left();
+        }
+        else
+            node = node->get_right();
+    }
+    
+    return next;
+}
+
+// find the bucket preceding the given key
+// precondition: none
+// postcondition: return the node of the bucket with the greatest
+// smallest key smaller than the key, nullptr if there is none
+template <class T, std::size_t B>
+typename BucketAVLTree<T,B>::Node* BucketAVLTree<T,B>::previous_node(const T& key) const
+{
+    Node* node     = get_root();
+    Node* previous = nullptr;
+    
+    while (node)
+    {
+        if (Base::node_key(node).keys[0] < key)
+        {
+            previous = node;
+            node     = node->get_right();
+        }
+        else
+            node = node->get_left();
+    }
+    
+    return previous;
+}
+
+// remove the node of a bucket from the tree
+// precondition: a bucket with the given smallest key exists
+// postcondition: node removed and the tree is kept balanced
+template <class T, std::size_t B>
+void BucketAVLTree<T,B>::remove_node(const T& smallest_key)
+{
+    // buckets are compared by their smallest key only
+    AVLBucket<T,B> probe;
+    probe.keys[0] = smallest_key;
+    probe.count   = 1;
+    
+    Base::remove(probe);
+}
+
+}
+#endif /* BucketAVLTree_h */
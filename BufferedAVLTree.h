@@ -0,0 +1,305 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BufferedAVLTree_h
+#define BufferedAVLTree_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// Thread-safe front-end of a shared AVLTree for write-heavy phases. Each
+// thread collects its insertions and removals in a small sorted buffer of its
+// own, holding the last operation on each key, and merges it into the tree
+// under the tree lock when it reaches the buffer capacity, when its oldest
+// operation is older than the maximum delay, or on demand. The insertions of
+// a merge are applied in ascending order through a finger, so that each one
+// descends from the previous position, and the lock is taken once per batch
+// instead of once per update. A lookup checks the buffer of the calling
+// thread before the tree, so a thread always reads its own writes; the
+// buffered updates of the other threads become visible when merged. The
+// delay is checked by the operations of the owning thread, flush_all()
+// merges the buffers of idle threads as well and frees those of the threads
+// that have ended.
+template<class T>
+class BufferedAVLTree
+{
+public:
+    // constructor with the capacity of the buffers and the maximum delay
+    BufferedAVLTree(std::size_t buffer_size = 64, std::chrono::microseconds max_delay = std::chrono::milliseconds(1)) :
+                    capacity(buffer_size ? buffer_size : 1), delay(max_delay), id(++instances) { };
+    BufferedAVLTree(const BufferedAVLTree<T>&) = delete;
+    BufferedAVLTree<T>& operator=(const BufferedAVLTree<T>&) = delete;
+    // buffered insertion and removal
+    void        insert(T key) { update(key, true); };
+    void        remove(T key) { update(key, false); };
+    // test for a key in the buffer of the calling thread, then in the tree
+    bool        find(T key);
+    // merge the buffer of the calling thread into the tree
+    void        flush();
+    // merge the buffers of all the threads into the tree and free the
+    // buffers of the ended threads
+    void        flush_all();
+    // number of elements once all the buffers are merged
+    std::size_t size();
+    // test of the shared tree once all the buffers are merged
+    bool        validate();
+private:
+    // buffered operation, insertion or removal
+    struct Entry
+    {
+        T    key;
+        bool insert;
+    };
+    // sorted operations of a thread and time of the oldest one, the owner
+    // expiring when the thread ends
+    struct Buffer
+    {
+        std::mutex         lock;
+        std::vector<Entry> entries;
+        std::chrono::steady_clock::time_point first;
+        std::weak_ptr<void> owner;
+    };
+    // sets and ways of the cache of each thread from the trees to its buffers
+    static constexpr std::size_t cache_sets = 4;
+    static constexpr std::size_t cache_ways = 4;
+    // private helper functions
+    Buffer&     local_buffer();
+    static const std::shared_ptr<void>& thread_token();
+    void        update(T key, bool insert);
+    void        merge(Buffer& buffer);
+    std::size_t lower_bound(const Buffer& buffer, const T& key) const;
+    AVLTree<T>        tree;
+    std::shared_mutex tree_lock;
+    // buffers of all the threads that used the tree
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::mutex        buffers_lock;
+    std::size_t       capacity;
+    std::chrono::microseconds delay;
+    // identifier of the tree, never reused so that stale cache entries of a
+    // former tree at the same address never match
+    std::uint64_t     id;
+    static inline std::atomic<std::uint64_t> instances { 0 };
+};
+
+// look up a key, the buffered operation of the calling thread taking
+// precedence over the tree
+// precondition: none
+// postcondition: return true if the key is found
+template <class T>
+bool BufferedAVLTree<T>::find(T key)
+{
+    Buffer& buffer = local_buffer();
+    {
+        std::lock_guard<std::mutex> guard(buffer.lock);
+        std::size_t k = lower_bound(buffer, key);
+        if (k < buffer.entries.size() && !(key < buffer.entries[k].key))
+            return buffer.entries[k].insert;
+    }
+    
+    std::shared_lock<std::shared_mutex> reader(tree_lock);
+    return tree.find(key) != nullptr;
+}
+
+// merge the buffer of the calling thread
+// precondition: none
+// postcondition: buffer empty, its operations applied to the tree
+template <class T>
+void BufferedAVLTree<T>::flush()
+{
+    Buffer& buffer = local_buffer();
+    std::lock_guard<std::mutex> guard(buffer.lock);
+    merge(buffer);
+}
+
+// merge every buffer, then free the buffers of the ended threads, which no
+// cache refers to anymore
+// precondition: none
+// postcondition: the operations buffered so far are applied to the tree,
+// one buffer left per thread alive that used the tree
+template <class T>
+void BufferedAVLTree<T>::flush_all()
+{
+    std::lock_guard<std::mutex> registry(buffers_lock);
+    for (std::unique_ptr<Buffer>& buffer : buffers)
+    {
+        std::lock_guard<std::mutex> guard(buffer->lock);
+        merge(*buffer);
+    }
+    
+    buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                 [](const std::unique_ptr<Buffer>& buffer) { return buffer->owner.expired(); }),
+                  buffers.end());
+}
+
+// number of elements
+// precondition: none
+// postcondition: all the buffers merged, return the number of elements
+template <class T>
+std::size_t BufferedAVLTree<T>::size()
+{
+    flush_all();
+    
+    std::shared_lock<std::shared_mutex> reader(tree_lock);
+    return tree.size();
+}
+
+// check the tree
+// precondition: none
+// postcondition: all the buffers merged, return true if the tree is consistent
+template <class T>
+bool BufferedAVLTree<T>::validate()
+{
+    flush_all();
+    
+    std::shared_lock<std::shared_mutex> reader(tree_lock);
+    return tree.validate() && tree.is_balanced();
+}
+
+// buffer of the calling thread, registered on its first use of the tree.
+// Each thread caches its buffers in a few sets of ways selected by the
+// identifier of the tree, the most recently used way first. A miss looks up
+// the buffer of the thread in the registry and replaces the least recently
+// used way of the set, so the cache keeps a fixed size whatever the number of
+// trees the thread has used
+// precondition: none
+// postcondition: return the buffer of the calling thread for this tree
+template <class T>
+typename BufferedAVLTree<T>::Buffer& BufferedAVLTree<T>::local_buffer()
+{
+    thread_local std::pair<std::uint64_t, Buffer*> cache[cache_sets][cache_ways] = {};
+    
+    std::pair<std::uint64_t, Buffer*>* set = cache[id % cache_sets];
+    for (std::size_t way = 0; way < cache_ways; way++)
+        if (set[way].first == id)
+        {
+            std::rotate(set, set + way, set + way + 1);
+            return *set[0].second;
+        }
+    
+    const std::shared_ptr<void>& token = thread_token();
+    std::lock_guard<std::mutex> registry(buffers_lock);
+    Buffer* buffer = nullptr;
+    for (const std::unique_ptr<Buffer>& candidate : buffers)
+        if (!candidate->owner.owner_before(token) && !token.owner_before(candidate->owner))
+        {
+            buffer = candidate.get();
+            break;
+        }
+    
+    if (!buffer)
+    {
+        buffers.push_back(std::make_unique<Buffer>());
+        buffer = buffers.back().get();
+        buffer->entries.reserve(capacity);
+        buffer->owner = token;
+    }
+    std::rotate(set, set + cache_ways - 1, set + cache_ways);
+    set[0] = { id, buffer };
+    
+    return *buffer;
+}
+
+// token of the calling thread, destroyed when the thread ends
+// precondition: none
+// postcondition: return the token of the thread
+template <class T>
+const std::shared_ptr<void>& BufferedAVLTree<T>::thread_token()
+{
+    thread_local std::shared_ptr<void> token = std::make_shared<char>(0);
+    return token;
+}
+
+// record an operation in the buffer of the calling thread, replacing any
+// buffered operation on the same key, and merge the buffer when full or old
+// precondition: none
+// postcondition: operation buffered or applied to the tree
+template <class T>
+void BufferedAVLTree<T>::update(T key, bool insert)
+{
+    Buffer& buffer = local_buffer();
+    std::lock_guard<std::mutex> guard(buffer.lock);
+    
+    auto now = std::chrono::steady_clock::now();
+    if (buffer.entries.empty())
+        buffer.first = now;
+    
+    std::size_t k = lower_bound(buffer, key);
+    if (k < buffer.entries.size() && !(key < buffer.entries[k].key))
+        buffer.entries[k].insert = insert;
+    else
+        buffer.entries.insert(buffer.entries.begin() + static_cast<std::ptrdiff_t>(k), { key, insert });
+    
+    if (buffer.entries.size() >= capacity || now - buffer.first >= delay)
+        merge(buffer);
+}
+
+// apply a buffer to the tree in one critical section: the keys are distinct,
+// so the insertions are applied first, in ascending order from a finger, then
+// the removals
+// precondition: buffer lock held
+// postcondition: buffer empty
+template <class T>
+void BufferedAVLTree<T>::merge(Buffer& buffer)
+{
+    if (buffer.entries.empty())
+        return;
+    
+    {
+        std::unique_lock<std::shared_mutex> writer(tree_lock);
+        AVLFinger<T> finger;
+        for (const Entry& entry : buffer.entries)
+            if (entry.insert)
+                tree.insert(finger, entry.key);
+        for (const Entry& entry : buffer.entries)
+            if (!entry.insert)
+                tree.remove(entry.key);
+    }
+    
+    buffer.entries.clear();
+}
+
+// position of the first buffered key not less than the given key
+// precondition: buffer lock held
+// postcondition: return an index in [0,size]
+template <class T>
+std::size_t BufferedAVLTree<T>::lower_bound(const Buffer& buffer, const T& key) const
+{
+    std::size_t low  = 0;
+    std::size_t high = buffer.entries.size();
+    while (low < high)
+    {
+        std::size_t middle = low + (high - low) / 2;
+        if (buffer.entries[middle].key < key)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+}
+#endif /* BufferedAVLTree_h */
@@ -0,0 +1,608 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DurableAVLTree_h
+#define DurableAVLTree_h
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// Thread-safe AVL tree persisted in two files, for POSIX systems. Every
+// insertion and removal is appended to a write-ahead log and applied to the
+// tree in memory once the log record is on stable storage, so the tree never
+// holds an operation a crash would lose. The callers arriving while the log
+// is being synced wait together and the first of them writes and syncs all
+// their records at once (group commit), so that concurrent callers share one
+// fsync, then applies them in the order of the log. After the given number of
+// logged operations a checkpoint copies the sorted keys, writes them to a new
+// snapshot without holding the lock, renames it over the previous one and
+// starts a new log.
+//
+// The files are <path>.ckpt and <path>.wal. Their headers hold a magic, the
+// format version, the key size and a generation number incremented by every
+// checkpoint, so that a log left over by a crash during the checkpoint is
+// recognized and ignored. A log record is the operation code byte, the key
+// bytes and a 32 bit checksum of both; the recovery stops at the first
+// incomplete or corrupted record, which a crash may leave at the end of the
+// log. The snapshot ends with a 32 bit checksum of its header and keys, and
+// is rejected if it is corrupted or its size does not match its key count.
+// The recovery keeps the last operation of the log on each key, merges them
+// with the keys of the snapshot and loads the result in one O(n) pass.
+template<class T>
+class DurableAVLTree
+{
+    static_assert(std::is_trivially_copyable<T>::value, "DurableAVLTree requires trivially copyable keys");
+public:
+    // constructor
+    DurableAVLTree() : wal(-1), generation(0), appended(0), durable(0), flushing(false), failed(false),
+                       logged(0), checkpoint_interval(1 << 20), syncs(0) { };
+    DurableAVLTree(const DurableAVLTree<T>&) = delete;
+    DurableAVLTree<T>& operator=(const DurableAVLTree<T>&) = delete;
+    // destructor
+    ~DurableAVLTree() { close(); };
+    // recover the tree stored at the given path, or start an empty one,
+    // return false if the files cannot be read or written
+    bool        open(const std::string& path);
+    // close the log, the logged operations are already durable
+    void        close();
+    bool        is_open() const { return wal >= 0; };
+    // durable insertion and removal, return false if the log cannot be written
+    bool        insert(T key) { return log(trace_insert, key); };
+    bool        remove(T key) { return log(trace_remove, key); };
+    // test for a key
+    bool        find(T key);
+    // number of elements
+    std::size_t size();
+    // write a snapshot of the tree and start a new log
+    bool        checkpoint();
+    // number of logged operations triggering a checkpoint
+    std::size_t get_checkpoint_interval() const { return checkpoint_interval; };
+    void        set_checkpoint_interval(std::size_t operations) { checkpoint_interval = operations; };
+    // number of syncs of the log, fewer than the operations with group commit
+    std::size_t get_syncs() const { return syncs; };
+private:
+    static constexpr std::size_t record_size = 1 + sizeof(T) + sizeof(std::uint32_t);
+    // private helper functions
+    bool        log(AVLTraceOperation operation, T key);
+    bool        write_checkpoint(std::unique_lock<std::mutex>& guard);
+    int         start_log(std::uint64_t number) const;
+    bool        read_checkpoint(std::vector<T>& keys);
+    bool        read_log(std::vector<AVLTraceRecord<T>>& records, off_t& end);
+    static bool write_all(int fd, const char* data, std::size_t size);
+    static bool read_all(int fd, char* data, std::size_t size);
+    static std::uint32_t checksum(const char* data, std::size_t size, std::uint32_t sum = 2166136261u);
+    AVLTree<T>    tree;
+    std::string   path;
+    int           wal;
+    std::uint64_t generation;
+    // records waiting for the next sync, their operations to be applied once
+    // synced, and sequence numbers of the last appended and of the last
+    // synced record
+    std::vector<char> buffer;
+    std::vector<AVLTraceRecord<T>> operations;
+    std::uint64_t appended;
+    std::uint64_t durable;
+    // a sync or a checkpoint is writing, the tree and the log are unchanged
+    // by the other callers meanwhile
+    bool          flushing;
+    // a write failed, the log cannot be trusted anymore
+    bool          failed;
+    // operations logged since the last checkpoint or failed attempt
+    std::size_t   logged;
+    std::size_t   checkpoint_interval;
+    std::size_t   syncs;
+    std::mutex    lock;
+    std::condition_variable flushed;
+};
+
+// headers of the files
+inline constexpr char          checkpoint_magic[8] = { 'A', 'V', 'L', 'C', 'K', 'P', 'T', ' ' };
+inline constexpr char          wal_magic[8]        = { 'A', 'V', 'L', 'W', 'A', 'L', ' ', ' ' };
+inline constexpr std::uint32_t durable_version     = 2;
+
+// load the snapshot, replay the valid part of the log on top of it and reopen
+// the log for appending
+// precondition: none
+// postcondition: return true if the tree is recovered and the log is open
+template <class T>
+bool DurableAVLTree<T>::open(const std::string& file_path)
+{
+    close();
+    
+    std::lock_guard<std::mutex> guard(lock);
+    tree.bulk_load(std::vector<T>());
+    path       = file_path;
+    generation = 0;
+    failed     = false;
+    appended   = durable = 0;
+    logged     = 0;
+    buffer.clear();
+    operations.clear();
+    
+    std::vector<T> keys;
+    std::vector<AVLTraceRecord<T>> records;
+    off_t end = 0;
+    if ( !read_checkpoint(keys) || !read_log(records, end) )
+        return false;
+    
+    // last operation of the log on each key, in key order
+    std::stable_sort(records.begin(), records.end(),
+                     [](const AVLTraceRecord<T>& a, const AVLTraceRecord<T>& b) { return a.key < b.key; });
+    std::vector<AVLTraceRecord<T>> last;
+    for (const AVLTraceRecord<T>& record : records)
+    {
+        if (!last.empty() && !(last.back().key < record.key))
+            last.back() = record;
+        else
+            last.push_back(record);
+    }
+    
+    // merge the snapshot with the inserted keys, without the removed ones
+    std::vector<T> merged;
+    merged.reserve(keys.size() + last.size());
+    std::size_t k = 0;
+    for (const AVLTraceRecord<T>& record : last)
+    {
+        while (k < keys.size() && keys[k] < record.key)
+            merged.push_back(keys[k++]);
+        if (k < keys.size() && !(record.key < keys[k]))
+            k++;
+        if (record.operation == trace_insert)
+            merged.push_back(record.key);
+    }
+    merged.insert(merged.end(), keys.begin() + static_cast<std::ptrdiff_t>(k), keys.end());
+    
+    tree.bulk_load(merged);
+    
+    // append after the last valid record, or start a log of this generation
+    if (end > 0)
+    {
+        wal = ::open((path + ".wal").c_str(), O_WRONLY);
+        if (wal >= 0 && (::ftruncate(wal, end) != 0 || ::lseek(wal, end, SEEK_SET) != end))
+        {
+            ::close(wal);
+            wal = -1;
+        }
+        logged = records.size();
+        return wal >= 0;
+    }
+    
+    wal = start_log(generation);
+    return wal >= 0;
+}
+
+// close the log
+// precondition: none
+// postcondition: log closed, the tree is kept in memory
+template <class T>
+void DurableAVLTree<T>::close()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    flushed.wait(guard, [this] { return !flushing; });
+    
+    if (wal >= 0)
+        ::close(wal);
+    wal = -1;
+}
+
+// find a key
+// precondition: none
+// postcondition: return true if the key is found
+template <class T>
+bool DurableAVLTree<T>::find(T key)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return tree.find(key) != nullptr;
+}
+
+// number of elements
+// precondition: none
+// postcondition: return the number of elements
+template <class T>
+std::size_t DurableAVLTree<T>::size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return tree.size();
+}
+
+// write a checkpoint once the running sync is over
+// precondition: none
+// postcondition: return true if the snapshot is written and the log restarted
+template <class T>
+bool DurableAVLTree<T>::checkpoint()
+{
+    std::unique_lock<std::mutex> guard(lock);
+    flushed.wait(guard, [this] { return !flushing; });
+    
+    if (wal < 0 || failed)
+        return false;
+    
+    return write_checkpoint(guard);
+}
+
+// log an operation and wait for its record to be synced. The first waiting
+// caller finding no sync running writes the whole buffer and syncs it without
+// holding the lock, while the next callers fill the buffer again, then applies
+// the synced operations to the tree
+// precondition: none
+// postcondition: return true if the operation is durable and applied, false
+// with the tree unchanged otherwise
+template <class T>
+bool DurableAVLTree<T>::log(AVLTraceOperation operation, T key)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (wal < 0 || failed)
+        return false;
+    
+    std::size_t size = buffer.size();
+    buffer.resize(size + record_size);
+    buffer[size] = static_cast<char>(operation);
+    std::memcpy(buffer.data() + size + 1, &key, sizeof(T));
+    std::uint32_t sum = checksum(buffer.data() + size, 1 + sizeof(T));
+    std::memcpy(buffer.data() + size + 1 + sizeof(T), &sum, sizeof(sum));
+    operations.push_back({ operation, key });
+    std::uint64_t sequence = ++appended;
+    logged++;
+    
+    // group commit
+    while (durable < sequence && !failed)
+    {
+        if (flushing)
+        {
+            flushed.wait(guard);
+            continue;
+        }
+        
+        flushing = true;
+        std::vector<char> records;
+        std::vector<AVLTraceRecord<T>> batch;
+        records.swap(buffer);
+        batch.swap(operations);
+        std::uint64_t last = appended;
+        int fd = wal;
+        
+        guard.unlock();
+        bool done = write_all(fd, records.data(), records.size()) && ::fsync(fd) == 0;
+        guard.lock();
+        
+        syncs++;
+        flushing = false;
+        if (done)
+        {
+            // in the order of the log, which is the order of the batches
+            for (const AVLTraceRecord<T>& record : batch)
+            {
+                if (record.operation == trace_insert)
+                    tree.insert(record.key);
+                else
+                    tree.remove(record.key);
+            }
+            durable = last;
+        }
+        else
+            failed = true;
+        flushed.notify_all();
+    }
+    
+    // the operation is durable even if the checkpoint fails, which is
+    // attempted again after another interval of operations
+    if (!failed && logged >= checkpoint_interval && !flushing)
+        (void)write_checkpoint(guard);
+    
+    return !failed;
+}
+
+// copy the sorted keys, then write them to a temporary snapshot, sync it,
+// rename it over the previous snapshot and start a new log without holding
+// the lock. The syncs wait meanwhile, so the records appended by the callers
+// go to the new log once it is in place. A crash before the rename keeps the
+// previous snapshot and log, a crash after it leaves a log of the previous
+// generation, ignored by the recovery
+// precondition: lock held by the guard, no sync running
+// postcondition: return true if the new snapshot and log are in place, the
+// lock is held again
+template <class T>
+bool DurableAVLTree<T>::write_checkpoint(std::unique_lock<std::mutex>& guard)
+{
+    // keys in ascending order by an in-order traversal
+    std::vector<T> keys;
+    keys.reserve(tree.size());
+    std::vector<const AVLNode<T>*> stack;
+    const AVLNode<T>* node = tree.get_root();
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        node = stack.back();
+        stack.pop_back();
+        keys.push_back(node->get_key());
+        node = node->get_right();
+    }
+    
+    std::uint64_t number = generation + 1;
+    flushing = true;
+    guard.unlock();
+    
+    std::string file_name = path + ".ckpt";
+    std::string temporary = file_name + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool done = fd >= 0;
+    
+    if (done)
+    {
+        std::uint64_t count = keys.size();
+        std::uint32_t header[2] = { durable_version, static_cast<std::uint32_t>(sizeof(T)) };
+        char block[sizeof(checkpoint_magic) + sizeof(header) + sizeof(number) + sizeof(count)];
+        std::memcpy(block, checkpoint_magic, sizeof(checkpoint_magic));
+        std::memcpy(block + sizeof(checkpoint_magic), header, sizeof(header));
+        std::memcpy(block + sizeof(checkpoint_magic) + sizeof(header), &number, sizeof(number));
+        std::memcpy(block + sizeof(checkpoint_magic) + sizeof(header) + sizeof(number), &count, sizeof(count));
+        
+        const char* body = reinterpret_cast<const char*>(keys.data());
+        std::uint32_t sum = checksum(body, keys.size() * sizeof(T), checksum(block, sizeof(block)));
+        done = write_all(fd, block, sizeof(block)) && write_all(fd, body, keys.size() * sizeof(T)) &&
+               write_all(fd, reinterpret_cast<const char*>(&sum), sizeof(sum)) && ::fsync(fd) == 0;
+        done = (::close(fd) == 0) && done;
+        if (!done || std::rename(temporary.c_str(), file_name.c_str()) != 0)
+        {
+            (void)std::remove(temporary.c_str());
+            done = false;
+        }
+    }
+    
+    int log_fd = -1;
+    if (done)
+    {
+        // sync the directory entry of the renamed snapshot
+        std::string::size_type slash = path.find_last_of('/');
+        std::string directory = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+        int dir = ::open(directory.c_str(), O_RDONLY);
+        if (dir >= 0)
+        {
+            (void)::fsync(dir);
+            ::close(dir);
+        }
+        
+        log_fd = start_log(number);
+    }
+    
+    guard.lock();
+    flushing = false;
+    flushed.notify_all();
+    
+    // the previous snapshot and log are still in use, the next attempt
+    // waits for another interval so that a persistent failure, e.g. a full
+    // disk, does not copy the keys at every operation
+    if (!done)
+    {
+        logged = operations.size();
+        return false;
+    }
+    
+    // the previous log is obsolete from now on, the buffered records are
+    // written to the new one by the next sync
+    ::close(wal);
+    wal = log_fd;
+    if (wal < 0)
+    {
+        failed = true;
+        return false;
+    }
+    generation = number;
+    logged     = operations.size();
+    
+    return true;
+}
+
+// create an empty log with the header of the given generation
+// precondition: the log of the tree is not written meanwhile
+// postcondition: return the descriptor of the log open with its header
+// synced, -1 on failure
+template <class T>
+int DurableAVLTree<T>::start_log(std::uint64_t number) const
+{
+    int fd = ::open((path + ".wal").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    
+    std::uint32_t header[2] = { durable_version, static_cast<std::uint32_t>(sizeof(T)) };
+    char block[sizeof(wal_magic) + sizeof(header) + sizeof(number)];
+    std::memcpy(block, wal_magic, sizeof(wal_magic));
+    std::memcpy(block + sizeof(wal_magic), header, sizeof(header));
+    std::memcpy(block + sizeof(wal_magic) + sizeof(header), &number, sizeof(number));
+    
+    if ( !write_all(fd, block, sizeof(block)) || ::fsync(fd) != 0 )
+    {
+        ::close(fd);
+        return -1;
+    }
+    
+    return fd;
+}
+
+// read the keys of the snapshot and its generation
+// precondition: none
+// postcondition: return false if the snapshot exists but is not valid, its
+// size does not match its key count or its checksum differs, otherwise the
+// keys are appended in ascending order, none without snapshot
+template <class T>
+bool DurableAVLTree<T>::read_checkpoint(std::vector<T>& keys)
+{
+    int fd = ::open((path + ".ckpt").c_str(), O_RDONLY);
+    if (fd < 0)
+        return true;
+    
+    std::uint32_t header[2];
+    std::uint64_t count = 0;
+    char block[sizeof(checkpoint_magic) + sizeof(header) + sizeof(generation) + sizeof(count)];
+    struct stat status;
+    bool done = ::fstat(fd, &status) == 0 && read_all(fd, block, sizeof(block));
+    if (done)
+    {
+        std::memcpy(header, block + sizeof(checkpoint_magic), sizeof(header));
+        std::memcpy(&count, block + sizeof(checkpoint_magic) + sizeof(header) + sizeof(generation), sizeof(count));
+        
+        // the key count is trusted only if the file holds exactly that many
+        // keys, before the checksum is even computed
+        std::uint64_t file_size = static_cast<std::uint64_t>(status.st_size);
+        std::uint64_t body      = file_size - sizeof(block) - sizeof(std::uint32_t);
+        done = std::memcmp(block, checkpoint_magic, sizeof(checkpoint_magic)) == 0 &&
+               header[0] == durable_version && header[1] == sizeof(T) &&
+               file_size >= sizeof(block) + sizeof(std::uint32_t) &&
+               body % sizeof(T) == 0 && count == body / sizeof(T);
+    }
+    if (done)
+    {
+        std::size_t first = keys.size();
+        std::uint32_t sum = 0;
+        keys.resize(first + count);
+        const char* data = reinterpret_cast<const char*>(keys.data() + first);
+        done = read_all(fd, reinterpret_cast<char*>(keys.data() + first), count * sizeof(T)) &&
+               read_all(fd, reinterpret_cast<char*>(&sum), sizeof(sum)) &&
+               sum == checksum(data, count * sizeof(T), checksum(block, sizeof(block)));
+        if (done)
+            std::memcpy(&generation, block + sizeof(checkpoint_magic) + sizeof(header), sizeof(generation));
+        else
+            keys.resize(first);
+    }
+    
+    ::close(fd);
+    
+    return done;
+}
+
+// read the valid records of the log of the current generation
+// precondition: generation of the snapshot read
+// postcondition: return false if the log is not valid or newer than the
+// snapshot, otherwise the records are appended and end is set past the last
+// valid record, 0 if the log is missing or obsolete
+template <class T>
+bool DurableAVLTree<T>::read_log(std::vector<AVLTraceRecord<T>>& records, off_t& end)
+{
+    end = 0;
+    int fd = ::open((path + ".wal").c_str(), O_RDONLY);
+    if (fd < 0)
+        return true;
+    
+    char magic[sizeof(wal_magic)];
+    std::uint32_t header[2];
+    std::uint64_t number = 0;
+    bool complete = read_all(fd, magic, sizeof(magic)) &&
+                    read_all(fd, reinterpret_cast<char*>(header), sizeof(header)) &&
+                    read_all(fd, reinterpret_cast<char*>(&number), sizeof(number));
+    
+    // a crash while the log was created leaves an incomplete header, a crash
+    // after a checkpoint an obsolete log: both are restarted
+    if (!complete || number < generation)
+    {
+        ::close(fd);
+        return true;
+    }
+    if (std::memcmp(magic, wal_magic, sizeof(magic)) != 0 || header[0] != durable_version ||
+        header[1] != sizeof(T) || number > generation)
+    {
+        ::close(fd);
+        return false;
+    }
+    
+    end = static_cast<off_t>(sizeof(magic) + sizeof(header) + sizeof(number));
+    char record[record_size];
+    while (read_all(fd, record, record_size))
+    {
+        std::uint32_t sum;
+        std::memcpy(&sum, record + 1 + sizeof(T), sizeof(sum));
+        if (sum != checksum(record, 1 + sizeof(T)) ||
+            (record[0] != static_cast<char>(trace_insert) && record[0] != static_cast<char>(trace_remove)))
+            break;
+        
+        AVLTraceRecord<T> entry;
+        entry.operation = static_cast<AVLTraceOperation>(record[0]);
+        std::memcpy(&entry.key, record + 1, sizeof(T));
+        records.push_back(entry);
+        end += static_cast<off_t>(record_size);
+    }
+    
+    ::close(fd);
+    
+    return true;
+}
+
+// write a whole buffer
+// precondition: open file descriptor
+// postcondition: return true if all the bytes are written
+template <class T>
+bool DurableAVLTree<T>::write_all(int fd, const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = ::write(fd, data, size);
+        if (count <= 0)
+            return false;
+        data += count;
+        size -= static_cast<std::size_t>(count);
+    }
+    return true;
+}
+
+// read a whole buffer
+// precondition: open file descriptor
+// postcondition: return true if all the bytes are read
+template <class T>
+bool DurableAVLTree<T>::read_all(int fd, char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t count = ::read(fd, data, size);
+        if (count <= 0)
+            return false;
+        data += count;
+        size -= static_cast<std::size_t>(count);
+    }
+    return true;
+}
+
+// FNV-1a hash of the bytes of a record or a snapshot, continued from the
+// given sum for data checksummed in several parts
+// precondition: none
+// postcondition: return the 32 bit checksum
+template <class T>
+std::uint32_t DurableAVLTree<T>::checksum(const char* data, std::size_t size, std::uint32_t sum)
+{
+    for (std::size_t k = 0; k < size; k++)
+        sum = (sum ^ static_cast<unsigned char>(data[k])) * 16777619u;
+    return sum;
+}
+
+}
+#endif /* DurableAVLTree_h */
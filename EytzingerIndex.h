@@ -0,0 +1,311 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef EytzingerIndex_h
+#define EytzingerIndex_h
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include "AVLTree.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace mathsophy
+{
+
+// Read-only index of the keys of an AVLTree stored in Eytzinger (breadth first)
+// order: the children of position k are at 2k and 2k+1, position 0 is unused.
+// The array is padded up to a complete tree with the largest key value, so
+// every lookup runs exactly the same number of branchless steps and all the
+// descendants of a node at a given depth are adjacent in memory. A lookup
+// ending on the largest value is a hit only if it is a key of the tree.
+template<class T>
+class EytzingerIndex
+{
+    static_assert(std::is_integral<T>::value, "EytzingerIndex requires integral keys");
+public:
+    // constructor
+    EytzingerIndex() : number_keys(0), levels(0), offset(0), has_max(false) { };
+    template<class P>
+    EytzingerIndex(const AVLTree<T,P>& tree) { build(tree); };
+    // copy the keys of the given tree into the index
+    template<class P>
+    void        build(const AVLTree<T,P>& tree);
+    // find an element
+    const T*    find(T key) const;
+    // find a batch of elements, out receives one pointer per key
+    void        find_batch(const std::vector<T>& keys, std::vector<const T*>& out) const;
+    // number of elements
+    std::size_t size() const { return number_keys; };
+    // test for empty index
+    bool        is_empty() const { return number_keys == 0; };
+    bool        is_not_empty() const { return number_keys != 0; };
+private:
+    // keys in a cache line, the descendants this many levels below a node
+    // fill exactly one cache line and are prefetched together
+    static constexpr std::size_t line_keys       = 64 / sizeof(T) ? 64 / sizeof(T) : 1;
+    static constexpr int         prefetch_levels = line_keys >= 16 ? 4 : line_keys >= 8 ? 3 : 2;
+    // private helper functions
+    const T*    base() const { return data.data() + offset; };
+    const T*    match(const T* a, std::size_t position, T key) const;
+    std::size_t descend(const T* a, T key) const;
+    std::size_t fill(const std::vector<T>& sorted, std::size_t next, std::size_t k);
+    void        find_lanes(const T* keys, std::size_t count, const T** out) const;
+    std::vector<T> data;
+    std::size_t    number_keys;
+    int            levels;
+    std::size_t    offset;
+    // the largest value is a key and not only padding
+    bool           has_max;
+};
+
+// copy the tree keys in Eytzinger order
+// precondition: the tree has less than 2^31 nodes
+// postcondition: the index holds the keys of the tree padded to a complete
+// tree, position 0 of the index is aligned to a cache line
+template <class T>
+template <class P>
+void EytzingerIndex<T>::build(const AVLTree<T,P>& tree)
+{
+    // sorted keys by in-order traversal, skipping the tombstones
+    std::vector<T> sorted;
+    std::vector<const AVLNode<T>*> stack;
+    const AVLNode<T>* node = tree.get_root();
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        node = stack.back();
+        stack.pop_back();
+        if ( AVLTree<T,P>::get_count(node) != 0 )
+            sorted.push_back(node->get_key());
+        node = node->get_right();
+    }
+    
+    number_keys = sorted.size();
+    has_max     = !sorted.empty() && sorted.back() == std::numeric_limits<T>::max();
+    levels      = 0;
+    while ((std::size_t(1) << levels) <= number_keys)
+        levels++;
+    
+    // the padding keys are never smaller than a searched key
+    std::size_t capacity = std::size_t(1) << levels;
+    sorted.resize(capacity - 1, std::numeric_limits<T>::max());
+    
+    // over-allocate to align position 0 to a cache line
+    data.assign(capacity + line_keys, std::numeric_limits<T>::max());
+    offset = (64 - reinterpret_cast<std::uintptr_t>(data.data()) % 64) % 64 / sizeof(T);
+    
+    (void)fill(sorted, 0, 1);
+}
+
+// find a key in the index
+// precondition: none
+// postcondition: return the pointer to the key if the key is found,
+// otherwise return a nullptr if the key is not found
+template <class T>
+const T* EytzingerIndex<T>::find(T key) const
+{
+    if ( is_empty() )
+        return nullptr;
+    
+    const T* a    = base();
+    std::size_t k = descend(a, key);
+    
+    return match(a, k, key);
+}
+
+// find a batch of keys. Groups of keys are searched in lock-step, with AVX2
+// gathers when available, otherwise with SSE2 compares or scalar code
+// precondition: none
+// postcondition: out holds the pointer to each key found, or a nullptr
+template <class T>
+void EytzingerIndex<T>::find_batch(const std::vector<T>& keys, std::vector<const T*>& out) const
+{
+    out.resize(keys.size());
+    
+    if ( is_empty() )
+    {
+        std::fill(out.begin(), out.end(), nullptr);
+        return;
+    }
+    
+    constexpr std::size_t lanes = 8;
+    std::size_t k = 0;
+    for (; k + lanes <= keys.size(); k += lanes)
+        find_lanes(keys.data() + k, lanes, out.data() + k);
+    if (k < keys.size())
+        find_lanes(keys.data() + k, keys.size() - k, out.data() + k);
+}
+
+// branchless descent of the complete tree. The position reached after the
+// last level encodes the path, its trailing ones are the right turns taken
+// after the last left turn, which is the lower bound of the key
+// precondition: non empty index
+// postcondition: return the position of the smallest key not less than the
+// given key, 0 if there is none
+template <class T>
+std::size_t EytzingerIndex<T>::descend(const T* a, T key) const
+{
+    std::size_t k = 1;
+    
+    for (int level = 0; level < levels; level++)
+    {
+        __builtin_prefetch(a + (k << prefetch_levels));
+        k = 2 * k + (a[k] < key);
+    }
+    
+    // drop the trailing right turns and the last left turn
+    k >>= __builtin_ctzll(~static_cast<unsigned long long>(k)) + 1;
+    
+    return k;
+}
+
+// result of a lookup ending at a position, the lower bound of the key. The
+// lower bound of the largest value is its first occurrence in key order, a
+// key of the tree if there is one, since the padding follows the keys
+// precondition: position returned by a descent
+// postcondition: return the pointer to the key if it is found, otherwise
+// return a nullptr
+template <class T>
+const T* EytzingerIndex<T>::match(const T* a, std::size_t position, T key) const
+{
+    if (!position || a[position] != key)
+        return nullptr;
+    if (key == std::numeric_limits<T>::max() && !has_max)
+        return nullptr;
+    return a + position;
+}
+
+// in-order fill of the implicit complete tree with the sorted keys
+// precondition: valid position k
+// postcondition: return the index of the next sorted key to place
+template <class T>
+std::size_t EytzingerIndex<T>::fill(const std::vector<T>& sorted, std::size_t next, std::size_t k)
+{
+    T* a = data.data() + offset;
+    
+    // the recursion depth is bounded by the number of levels
+    if (k <= sorted.size())
+    {
+        next = fill(sorted, next, 2 * k);
+        a[k] = sorted[next++];
+        next = fill(sorted, next, 2 * k + 1);
+    }
+    
+    return next;
+}
+
+// search up to eight keys in lock-step
+// precondition: count between 1 and 8, non empty index
+// postcondition: out holds the pointer to each key found, or a nullptr
+template <class T>
+void EytzingerIndex<T>::find_lanes(const T* keys, std::size_t count, const T** out) const
+{
+    const T* a = base();
+    std::size_t k[8];
+
+#if defined(__AVX2__)
+    if (sizeof(T) == 4 && count == 8 && (std::size_t(1) << levels) <= std::size_t(INT32_MAX))
+    {
+        // unsigned keys are compared as signed after flipping the sign bit
+        const __m256i flip = _mm256_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m256i x    = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys)), flip);
+        __m256i index      = _mm256_set1_epi32(1);
+        alignas(32) std::uint32_t lanes[8];
+        
+        for (int level = 0; level < levels; level++)
+        {
+            __m256i node = _mm256_xor_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(a), index, 4), flip);
+            // the comparison mask is -1 where the node key is smaller
+            __m256i less = _mm256_cmpgt_epi32(x, node);
+            index = _mm256_sub_epi32(_mm256_add_epi32(index, index), less);
+            
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), index);
+            for (std::size_t lane = 0; lane < 8; lane++)
+                __builtin_prefetch(a + (std::size_t(lanes[lane]) << prefetch_levels));
+        }
+        
+        for (std::size_t lane = 0; lane < 8; lane++)
+            k[lane] = lanes[lane];
+    }
+    else
+#elif defined(__SSE2__)
+    if (sizeof(T) == 4 && count == 8)
+    {
+        // two vectors of four lanes, the node keys are loaded one by one
+        const __m128i flip = _mm_set1_epi32(std::is_signed<T>::value ? 0 : INT32_MIN);
+        const __m128i x0   = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)), flip);
+        const __m128i x1   = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + 4)), flip);
+        for (std::size_t lane = 0; lane < 8; lane++)
+            k[lane] = 1;
+        
+        for (int level = 0; level < levels; level++)
+        {
+            __m128i node0 = _mm_set_epi32(int(a[k[3]]), int(a[k[2]]), int(a[k[1]]), int(a[k[0]]));
+            __m128i node1 = _mm_set_epi32(int(a[k[7]]), int(a[k[6]]), int(a[k[5]]), int(a[k[4]]));
+            // one bit per lane where the node key is smaller
+            int less = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x0, _mm_xor_si128(node0, flip)))) |
+                       _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(x1, _mm_xor_si128(node1, flip)))) << 4;
+            for (std::size_t lane = 0; lane < 8; lane++)
+            {
+                k[lane] = 2 * k[lane] + ((less >> lane) & 1);
+                __builtin_prefetch(a + (k[lane] << prefetch_levels));
+            }
+        }
+    }
+    else
+#endif
+    {
+        // scalar lock-step descent, the independent loads overlap
+        for (std::size_t lane = 0; lane < count; lane++)
+            k[lane] = 1;
+        for (int level = 0; level < levels; level++)
+            for (std::size_t lane = 0; lane < count; lane++)
+            {
+                __builtin_prefetch(a + (k[lane] << prefetch_levels));
+                k[lane] = 2 * k[lane] + (a[k[lane]] < keys[lane]);
+            }
+    }
+    
+    for (std::size_t lane = 0; lane < count; lane++)
+    {
+        std::size_t position = k[lane] >> (__builtin_ctzll(~static_cast<unsigned long long>(k[lane])) + 1);
+        out[lane] = match(a, position, keys[lane]);
+    }
+}
+
+// read-only index of the tree keys in Eytzinger layout
+// precondition: none
+// postcondition: return an index containing the keys of the tree
+template <class T, class P>
+EytzingerIndex<T> AVLTree<T,P>::export_eytzinger() const
+{
+    return EytzingerIndex<T>(*this);
+}
+
+}
+#endif /* EytzingerIndex_h */
@@ -0,0 +1,282 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FrozenAVLTree_h
+#define FrozenAVLTree_h
+
+#include <vector>
+#include <cstdint>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// Read-only snapshot of an AVLTree. The nodes are stored in one contiguous
+// buffer following the van Emde Boas order: the top half of the tree levels
+// is laid out first, then each of the bottom subtrees from left to right,
+// recursively. A root to leaf path therefore touches O(log_B n) cache lines
+// and pages for any block size B, without tuning for the cache hierarchy.
+template<class T>
+class FrozenAVLTree
+{
+public:
+    // constructor
+    FrozenAVLTree() { };
+    template<class P>
+    FrozenAVLTree(const AVLTree<T,P>& tree) { freeze(tree); };
+    // re-lay out the given tree into the contiguous buffer
+    template<class P>
+    void        freeze(const AVLTree<T,P>& tree);
+    // find an element
+    const T*    find(T key) const;
+    // append the elements in [low,high] in ascending order
+    void        find_range(T low, T high, std::vector<T>& keys) const;
+    // number of elements
+    std::size_t size() const { return nodes.size(); };
+    // test for empty tree
+    bool        is_empty() const { return nodes.empty(); };
+    bool        is_not_empty() const { return !nodes.empty(); };
+private:
+    // node of the snapshot, children are indices into the buffer
+    struct FrozenNode
+    {
+        T             key;
+        std::uint32_t left;
+        std::uint32_t right;
+    };
+    // node of the intermediate copy used to compute the layout
+    struct SourceNode
+    {
+        const AVLNode<T>* node;
+        std::uint32_t     left;
+        std::uint32_t     right;
+    };
+    static constexpr std::uint32_t none = UINT32_MAX;
+    // private helper functions
+    static void layout(const std::vector<SourceNode>& source, std::uint32_t index,
+                       int levels, std::vector<std::uint32_t>& order);
+    static void subtree_roots(const std::vector<SourceNode>& source, std::uint32_t index,
+                              int depth, std::vector<std::uint32_t>& roots);
+    std::vector<FrozenNode> nodes;
+};
+
+// re-lay out the tree in van Emde Boas order
+// precondition: the tree has less than UINT32_MAX nodes
+// postcondition: the snapshot contains the keys of the tree except the
+// tombstones, the root is stored at index 0
+template <class T>
+template <class P>
+void FrozenAVLTree<T>::freeze(const AVLTree<T,P>& tree)
+{
+    nodes.clear();
+    
+    if ( tree.is_empty() )
+        return;
+    
+    // the snapshot mirrors the tree shape, the tombstones are purged from a copy
+    if (tree.get_tombstones() > 0)
+    {
+        AVLTree<T,P> copy;
+        copy = tree;
+        copy.compact();
+        freeze(copy);
+        return;
+    }
+    
+    // copy the tree shape into an index based representation,
+    // each stack entry holds the node, its parent index and side
+    std::vector<SourceNode> source;
+    std::vector<std::pair<const AVLNode<T>*, std::uint32_t>> stack;
+    std::vector<bool> is_right;
+    stack.push_back({tree.get_root(), none});
+    is_right.push_back(false);
+    while (!stack.empty())
+    {
+        const AVLNode<T>* node = stack.back().first;
+        std::uint32_t parent   = stack.back().second;
+        bool right             = is_right.back();
+        stack.pop_back();
+        is_right.pop_back();
+        
+        std::uint32_t index = static_cast<std::uint32_t>(source.size());
+        source.push_back({node, none, none});
+        if (parent != none)
+        {
+            if (right)
+                source[parent].right = index;
+            else
+                source[parent].left  = index;
+        }
+        
+        if (node->get_right())
+        {
+            stack.push_back({node->get_right(), index});
+            is_right.push_back(true);
+        }
+        if (node->get_left())
+        {
+            stack.push_back({node->get_left(), index});
+            is_right.push_back(false);
+        }
+    }
+    
+    // compute the van Emde Boas order of the nodes
+    std::vector<std::uint32_t> order;
+    order.reserve(source.size());
+    layout(source, 0, tree.get_root()->get_height(), order);
+    
+    // position of each source node in the snapshot
+    std::vector<std::uint32_t> position(source.size());
+    for (std::uint32_t k = 0; k < order.size(); k++)
+        position[order[k]] = k;
+    
+    nodes.reserve(order.size());
+    for (std::uint32_t index : order)
+    {
+        const SourceNode& node = source[index];
+        nodes.push_back({node.node->get_key(),
+                         node.left  == none ? none : position[node.left],
+                         node.right == none ? none : position[node.right]});
+    }
+}
+
+// find a key in the snapshot
+// precondition: none
+// postcondition: return the pointer to the key if the key is found,
+// otherwise return a nullptr if the key is not found
+template <class T>
+const T* FrozenAVLTree<T>::find(T key) const
+{
+    if ( is_empty() )
+        return nullptr;
+    
+    std::uint32_t index = 0;
+    
+    // tree traversal
+    while (index != none)
+    {
+        const FrozenNode& node = nodes[index];
+        if (key > node.key)
+            index = node.right;
+        else if (key < node.key)
+            index = node.left;
+        else
+        // key found!
+            return &node.key;
+    }
+    
+    return nullptr;
+}
+
+// collect the keys in the closed interval [low,high]
+// precondition: none
+// postcondition: the keys found are appended to the vector in ascending order
+template <class T>
+void FrozenAVLTree<T>::find_range(T low, T high, std::vector<T>& keys) const
+{
+    if ( is_empty() )
+        return;
+    
+    // in-order traversal skipping the subtrees out of range
+    std::vector<std::uint32_t> stack;
+    std::uint32_t index = 0;
+    while (index != none || !stack.empty())
+    {
+        // go down to the left as long as keys can be in range
+        while (index != none)
+        {
+            stack.push_back(index);
+            index = (nodes[index].key > low) ? nodes[index].left : none;
+        }
+        
+        const FrozenNode& node = nodes[stack.back()];
+        stack.pop_back();
+        
+        if (node.key > high)
+            break;
+        if (!(node.key < low))
+            keys.push_back(node.key);
+        
+        index = node.right;
+    }
+}
+
+// lay out the first levels of the subtree in van Emde Boas order: first the
+// top half of the levels, then the bottom subtrees from left to right
+// precondition: valid source node index and positive number of levels
+// postcondition: the node indices are appended to the order vector
+template <class T>
+void FrozenAVLTree<T>::layout(const std::vector<SourceNode>& source, std::uint32_t index,
+                              int levels, std::vector<std::uint32_t>& order)
+{
+    if (levels == 1)
+    {
+        order.push_back(index);
+        return;
+    }
+    
+    int top    = levels / 2;
+    int bottom = levels - top;
+    
+    layout(source, index, top, order);
+    
+    std::vector<std::uint32_t> roots;
+    subtree_roots(source, index, top, roots);
+    for (std::uint32_t root : roots)
+        layout(source, root, bottom, order);
+}
+
+// collect the roots of the subtrees hanging at the given depth
+// precondition: valid source node index and positive depth
+// postcondition: the subtree roots are appended from left to right
+template <class T>
+void FrozenAVLTree<T>::subtree_roots(const std::vector<SourceNode>& source, std::uint32_t index,
+                                     int depth, std::vector<std::uint32_t>& roots)
+{
+    std::vector<std::pair<std::uint32_t, int>> stack;
+    stack.push_back({index, 0});
+    while (!stack.empty())
+    {
+        std::uint32_t node = stack.back().first;
+        int level          = stack.back().second;
+        stack.pop_back();
+        
+        if (level == depth)
+        {
+            roots.push_back(node);
+            continue;
+        }
+        
+        // push right first so that the left subtrees come out first
+        if (source[node].right != none)
+            stack.push_back({source[node].right, level + 1});
+        if (source[node].left != none)
+            stack.push_back({source[node].left, level + 1});
+    }
+}
+
+// read-only snapshot of the tree in van Emde Boas layout
+// precondition: none
+// postcondition: return a snapshot containing the keys of the tree
+template <class T, class P>
+FrozenAVLTree<T> AVLTree<T,P>::freeze() const
+{
+    return FrozenAVLTree<T>(*this);
+}
+
+}
+#endif /* FrozenAVLTree_h */
@@ -0,0 +1,214 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef IntervalAVLTree_h
+#define IntervalAVLTree_h
+
+#include <vector>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// Closed interval [low,high] together with the largest high endpoint of the
+// intervals in its subtree. Intervals are ordered by their low endpoint, then
+// by their high endpoint.
+template<class T>
+struct AVLInterval
+{
+    // ordering of the intervals
+    bool operator<(const AVLInterval<T>& interval) const
+    {
+        return low < interval.low || (!(interval.low < low) && high < interval.high);
+    };
+    bool operator>(const AVLInterval<T>& interval) const { return interval < *this; };
+    // largest high endpoint of the subtree, from the ones of the children
+    void augment(const AVLInterval<T>* left, const AVLInterval<T>* right)
+    {
+        max = high;
+        if (left && max < left->max)
+            max = left->max;
+        if (right && max < right->max)
+            max = right->max;
+    };
+    T low;
+    T high;
+    T max;
+};
+
+// AVL tree of closed intervals for overlap queries. Every node keeps the
+// largest high endpoint of its subtree, updated by AVLTree along with the
+// subtree sizes through insertions, removals and rotations, so that the
+// subtrees ending before a query are skipped. Identical intervals are
+// stored once.
+template<class T>
+class IntervalAVLTree : protected AVLTree<AVLInterval<T>>
+{
+public:
+    // constructor
+    IntervalAVLTree() { };
+    // balanced insertion of the interval [low,high]
+    void        insert(T low, T high) { Base::insert(interval(low, high)); };
+    // balanced removal of the interval [low,high]
+    void        remove(T low, T high) { Base::remove(interval(low, high)); };
+    // test for the interval [low,high]
+    bool        find(T low, T high) const;
+    // call fn(low, high) for every interval overlapping [low,high], in order
+    template<class F>
+    void        find_overlapping(T low, T high, F fn) const;
+    // test for an interval overlapping [low,high]
+    bool        any_overlap(T low, T high) const;
+    // test of the tree structure and of the endpoint summaries
+    bool        validate() const;
+    // number of intervals
+    using AVLTree<AVLInterval<T>>::size;
+    // test for balanced tree
+    using AVLTree<AVLInterval<T>>::is_balanced;
+    using AVLTree<AVLInterval<T>>::is_not_balanced;
+    // test for empty tree
+    using AVLTree<AVLInterval<T>>::is_empty;
+    using AVLTree<AVLInterval<T>>::is_not_empty;
+private:
+    typedef AVLTree<AVLInterval<T>> Base;
+    typedef AVLNode<AVLInterval<T>> Node;
+    static AVLInterval<T> interval(T low, T high) { return { low, high, high }; };
+};
+
+// find an interval
+// precondition: none
+// postcondition: return true if the interval [low,high] is in the tree
+template <class T>
+bool IntervalAVLTree<T>::find(T low, T high) const
+{
+    const AVLInterval<T> key = interval(low, high);
+    Node* node = Base::get_root();
+    
+    // tree traversal
+    while (node)
+    {
+        if (key > Base::node_key(node))
+            node = node->get_right();
+        else if (key < Base::node_key(node))
+            node = node->get_left();
+        else
+        // key found!
+            return true;
+    }
+    
+    return false;
+}
+
+// report the intervals overlapping [low,high] by an in-order traversal that
+// skips the subtrees whose largest endpoint is below low, and stops at the
+// first interval starting after high. Every visited node either overlaps or
+// lies on the path to an overlapping one, so at most O(log n) nodes are
+// visited per reported interval, close to O(log n + k) in practice.
+// precondition: low not greater than high
+// postcondition: fn called once per overlapping interval, in ascending order
+template <class T>
+template <class F>
+void IntervalAVLTree<T>::find_overlapping(T low, T high, F fn) const
+{
+    std::vector<Node*> stack;
+    Node* node = Base::get_root();
+    
+    while (node || !stack.empty())
+    {
+        // go down the left subtrees reaching low
+        while (node && !(Base::node_key(node).max < low))
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        
+        if (stack.empty())
+            break;
+        
+        node = stack.back();
+        stack.pop_back();
+        
+        // the following intervals start after high as well
+        const AVLInterval<T>& current = Base::node_key(node);
+        if (high < current.low)
+            break;
+        
+        if (!(current.high < low))
+            fn(current.low, current.high);
+        
+        node = node->get_right();
+    }
+}
+
+// test for an overlapping interval by a single descent: when the left subtree
+// reaches low and has no overlapping interval, neither has the right one
+// precondition: low not greater than high
+// postcondition: return true if an interval overlaps [low,high]
+template <class T>
+bool IntervalAVLTree<T>::any_overlap(T low, T high) const
+{
+    Node* node = Base::get_root();
+    
+    while (node)
+    {
+        const AVLInterval<T>& current = Base::node_key(node);
+        if (!(current.high < low) && !(high < current.low))
+            return true;
+        
+        Node* left = node->get_left();
+        if (left && !(Base::node_key(left).max < low))
+            node = left;
+        else
+            node = node->get_right();
+    }
+    
+    return false;
+}
+
+// check the tree and the largest endpoint kept by every node
+// precondition: none
+// postcondition: return true if the tree is consistent, false otherwise
+template <class T>
+bool IntervalAVLTree<T>::validate() const
+{
+    if ( !Base::validate() )
+        return false;
+    
+    std::vector<Node*> stack;
+    if ( is_not_empty() )
+        stack.push_back(Base::get_root());
+    while (!stack.empty())
+    {
+        Node* node = stack.back();
+        stack.pop_back();
+        
+        AVLInterval<T> expected = Base::node_key(node);
+        expected.augment(node->get_left() ? &Base::node_key(node->get_left()) : nullptr,
+                         node->get_right() ? &Base::node_key(node->get_right()) : nullptr);
+        if (expected.max < Base::node_key(node).max || Base::node_key(node).max < expected.max)
+            return false;
+        
+        if (node->get_left())
+            stack.push_back(node->get_left());
+        if (node->get_right())
+            stack.push_back(node->get_right());
+    }
+    
+    return true;
+}
+
+}
+#endif /* IntervalAVLTree_h */
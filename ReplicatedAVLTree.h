@@ -0,0 +1,329 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ReplicatedAVLTree_h
+#define ReplicatedAVLTree_h
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "AVLTree.h"
+
+#ifdef AVLTREE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#endif
+
+namespace mathsophy
+{
+
+// Thread-safe AVL tree replicated once per NUMA node for read-mostly
+// workloads, in the style of node replication: the insertions and removals
+// are appended to a shared operation log and every replica applies the log
+// in the same order, so all replicas go through the same states. A lookup
+// first brings the replica of the calling thread up to the end of the log,
+// then searches it under a shared lock, so it only touches memory of the
+// local node and sees every update completed before it started.
+//
+// With -DAVLTREE_NUMA (link with -lnuma) there is one replica per NUMA node
+// the process may allocate on, the threads read the replica of the node they
+// run on, and the nodes of a replica are allocated preferably on its NUMA node
+// while the log is applied to it, the memory policy of the applying thread
+// being restored afterwards. Without the macro the replicas are assigned to
+// the threads by their identifier, which still spreads the readers over
+// independent locks.
+template<class T>
+class ReplicatedAVLTree
+{
+public:
+    // constructor, one replica per NUMA node
+    ReplicatedAVLTree() : ReplicatedAVLTree(numa_nodes()) { };
+    // constructor with the number of replicas and of log entries
+    explicit ReplicatedAVLTree(unsigned int replicas, std::size_t log_size = 4096);
+    ReplicatedAVLTree(const ReplicatedAVLTree<T>&) = delete;
+    ReplicatedAVLTree<T>& operator=(const ReplicatedAVLTree<T>&) = delete;
+    // insertion and removal of a key, applied to all the replicas
+    void         insert(T key) { append(trace_insert, key); };
+    void         remove(T key) { append(trace_remove, key); };
+    // test for a key in the local replica
+    bool         find(T key);
+    // number of elements
+    std::size_t  size();
+    // bring all the replicas up to the end of the log
+    void         synchronize();
+    // test that all the replicas are consistent and hold the same keys
+    bool         validate();
+    // number of replicas and replica read by the calling thread
+    unsigned int get_replicas() const { return static_cast<unsigned int>(replicas.size()); };
+    unsigned int local_replica() const;
+private:
+    // copy of the tree with its lock, the number of log entries applied and
+    // the NUMA node its nodes are allocated on, -1 for none
+    struct Replica
+    {
+        AVLTree<T>                 tree;
+        std::shared_mutex          lock;
+        std::atomic<std::uint64_t> applied { 0 };
+        int                        node = -1;
+    };
+    // private helper functions
+    static unsigned int numa_nodes();
+    static std::vector<int> allowed_nodes();
+    void         append(AVLTraceOperation operation, T key);
+    void         update(unsigned int replica, std::uint64_t end);
+    std::vector<std::unique_ptr<Replica>> replicas;
+    // replica of each NUMA node, -1 for the nodes without one
+    std::vector<int> node_replicas;
+    // circular operation log, the entry of position k is at k modulo its size
+    std::vector<AVLTraceRecord<T>> log;
+    std::atomic<std::uint64_t>     tail;
+    std::mutex                     log_lock;
+};
+
+// create the replicas and the operation log, the replicas being assigned to
+// the allowed NUMA nodes in ascending order
+// precondition: none
+// postcondition: empty replicas, at least one
+template <class T>
+ReplicatedAVLTree<T>::ReplicatedAVLTree(unsigned int replicas, std::size_t log_size) : log(log_size ? log_size : 1), tail(0)
+{
+    std::vector<int> nodes = allowed_nodes();
+    for (unsigned int k = 0; k < (replicas ? replicas : 1); k++)
+    {
+        this->replicas.push_back(std::make_unique<Replica>());
+        if (k < nodes.size())
+        {
+            int node = nodes[k];
+            if (node_replicas.size() <= static_cast<std::size_t>(node))
+                node_replicas.resize(static_cast<std::size_t>(node) + 1, -1);
+            node_replicas[static_cast<std::size_t>(node)] = static_cast<int>(k);
+            this->replicas.back()->node = node;
+        }
+    }
+}
+
+// search the local replica after applying the pending operations
+// precondition: none
+// postcondition: return true if the key is found
+template <class T>
+bool ReplicatedAVLTree<T>::find(T key)
+{
+    unsigned int local = local_replica();
+    Replica& replica   = *replicas[local];
+    
+    std::uint64_t end = tail.load(std::memory_order_acquire);
+    if (replica.applied.load(std::memory_order_acquire) < end)
+        update(local, end);
+    
+    std::shared_lock<std::shared_mutex> reader(replica.lock);
+    return replica.tree.find(key) != nullptr;
+}
+
+// number of elements of the local replica once up to date
+// precondition: none
+// postcondition: return the number of elements
+template <class T>
+std::size_t ReplicatedAVLTree<T>::size()
+{
+    unsigned int local = local_replica();
+    update(local, tail.load(std::memory_order_acquire));
+    
+    std::shared_lock<std::shared_mutex> reader(replicas[local]->lock);
+    return replicas[local]->tree.size();
+}
+
+// apply the whole log to every replica
+// precondition: none
+// postcondition: all the replicas include the operations completed so far
+template <class T>
+void ReplicatedAVLTree<T>::synchronize()
+{
+    std::uint64_t end = tail.load(std::memory_order_acquire);
+    for (unsigned int k = 0; k < replicas.size(); k++)
+        update(k, end);
+}
+
+// check every replica against the first one
+// precondition: no concurrent updates
+// postcondition: return true if the replicas are consistent, false otherwise
+template <class T>
+bool ReplicatedAVLTree<T>::validate()
+{
+    synchronize();
+    
+    std::vector<T> reference;
+    for (unsigned int k = 0; k < replicas.size(); k++)
+    {
+        AVLTree<T>& tree = replicas[k]->tree;
+        if ( !tree.validate() || tree.is_not_balanced() )
+            return false;
+        
+        // in-order traversal
+        std::vector<T> keys;
+        std::vector<const AVLNode<T>*> stack;
+        const AVLNode<T>* node = tree.get_root();
+        while (node || !stack.empty())
+        {
+            while (node)
+            {
+                stack.push_back(node);
+                node = node->get_left();
+            }
+            node = stack.back();
+            stack.pop_back();
+            keys.push_back(node->get_key());
+            node = node->get_right();
+        }
+        if (k == 0)
+            reference.swap(keys);
+        else if (keys != reference)
+            return false;
+    }
+    
+    return true;
+}
+
+// replica of the NUMA node of the calling thread, or of its identifier
+// precondition: none
+// postcondition: return a replica index
+template <class T>
+unsigned int ReplicatedAVLTree<T>::local_replica() const
+{
+#ifdef AVLTREE_NUMA
+    int cpu  = sched_getcpu();
+    int node = (cpu < 0 || numa_available() < 0) ? 0 : numa_node_of_cpu(cpu);
+    if (node < 0)
+        return 0;
+    if (static_cast<std::size_t>(node) < node_replicas.size() && node_replicas[static_cast<std::size_t>(node)] >= 0)
+        return static_cast<unsigned int>(node_replicas[static_cast<std::size_t>(node)]);
+    return static_cast<unsigned int>(node) % replicas.size();
+#else
+    return static_cast<unsigned int>(std::hash<std::thread::id>{}(std::this_thread::get_id()) % replicas.size());
+#endif
+}
+
+// number of NUMA nodes the process may allocate memory on
+// precondition: none
+// postcondition: return 1 without NUMA support
+template <class T>
+unsigned int ReplicatedAVLTree<T>::numa_nodes()
+{
+    std::size_t count = allowed_nodes().size();
+    return count ? static_cast<unsigned int>(count) : 1;
+}
+
+// NUMA nodes the process may allocate memory on, which need not be numbered
+// contiguously, e.g. under a cpuset
+// precondition: none
+// postcondition: return the node identifiers in ascending order, none
+// without NUMA support
+template <class T>
+std::vector<int> ReplicatedAVLTree<T>::allowed_nodes()
+{
+    std::vector<int> nodes;
+#ifdef AVLTREE_NUMA
+    if (numa_available() < 0)
+        return nodes;
+    
+    struct bitmask* allowed = numa_get_mems_allowed();
+    if (!allowed)
+        return nodes;
+    for (int node = 0; node <= numa_max_node(); node++)
+        if ( numa_bitmask_isbitset(allowed, static_cast<unsigned int>(node)) )
+            nodes.push_back(node);
+    numa_bitmask_free(allowed);
+#endif
+    return nodes;
+}
+
+// append an operation to the log and apply it to the local replica. When the
+// log is full, the writer first brings the replicas lagging a whole log
+// behind up to date, so that no entry is overwritten before every replica
+// has applied it
+// precondition: none
+// postcondition: operation visible to all the following lookups
+template <class T>
+void ReplicatedAVLTree<T>::append(AVLTraceOperation operation, T key)
+{
+    std::uint64_t end;
+    {
+        std::lock_guard<std::mutex> writer(log_lock);
+        end = tail.load(std::memory_order_relaxed);
+        
+        for (unsigned int k = 0; k < replicas.size(); k++)
+            if (end - replicas[k]->applied.load(std::memory_order_acquire) >= log.size())
+                update(k, end);
+        
+        log[end % log.size()] = { operation, key };
+        tail.store(++end, std::memory_order_release);
+    }
+    
+    update(local_replica(), end);
+}
+
+// apply the log entries up to the given position to a replica, with its nodes
+// allocated on its NUMA node. The memory policy of the calling thread is saved
+// and set back afterwards, so that a policy of the caller, e.g. a binding or
+// an interleaving, survives the update
+// precondition: end not beyond the tail of the log
+// postcondition: replica applied at least up to end, memory policy of the
+// calling thread unchanged
+template <class T>
+void ReplicatedAVLTree<T>::update(unsigned int replica, std::uint64_t end)
+{
+    Replica& copy = *replicas[replica];
+    std::unique_lock<std::shared_mutex> writer(copy.lock);
+    
+    std::uint64_t position = copy.applied.load(std::memory_order_relaxed);
+    if (position >= end)
+        return;
+
+#ifdef AVLTREE_NUMA
+    int mode = MPOL_DEFAULT;
+    struct bitmask* mask = copy.node >= 0 ? numa_allocate_nodemask() : nullptr;
+    bool numa = mask && get_mempolicy(&mode, mask->maskp, mask->size + 1, nullptr, 0) == 0;
+    if (numa)
+        numa_set_preferred(copy.node);
+#endif
+    
+    for (; position < end; position++)
+    {
+        const AVLTraceRecord<T>& entry = log[position % log.size()];
+        if (entry.operation == trace_insert)
+            copy.tree.insert(entry.key);
+        else
+            copy.tree.remove(entry.key);
+    }
+
+#ifdef AVLTREE_NUMA
+    if (numa)
+        (void)set_mempolicy(mode, mask->maskp, mask->size + 1);
+    if (mask)
+        numa_bitmask_free(mask);
+#endif
+    
+    copy.applied.store(position, std::memory_order_release);
+}
+
+}
+#endif /* ReplicatedAVLTree_h */
@@ -0,0 +1,231 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef StaticAVLTree_h
+#define StaticAVLTree_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace mathsophy
+{
+
+// AVL tree of at most N keys built in constant expressions. The nodes are
+// taken from a fixed array instead of the heap, so a constexpr tree is
+// materialized at compile time into read-only data and costs nothing at
+// startup. The keys are sorted and the tree is built fully balanced, the
+// middle key of every range becoming the root of its subtree, so its height
+// is the smallest possible. The key type must be a literal type with a
+// default constructor, ordered by < and >.
+template<class T, std::size_t N>
+class StaticAVLTree
+{
+    static_assert(N > 0 && N < UINT32_MAX, "StaticAVLTree requires between 1 and UINT32_MAX - 1 keys");
+public:
+    // constructor from the keys in any order, duplicates are stored once
+    constexpr StaticAVLTree(const T (&keys)[N]);
+    // find an element
+    constexpr const T*    find(const T& key) const;
+    constexpr bool        contains(const T& key) const { return find(key) != nullptr; };
+    // append the elements in [low,high] in ascending order
+    void                  find_range(const T& low, const T& high, std::vector<T>& keys) const;
+    // number of elements
+    constexpr std::size_t size() const { return count; };
+    static constexpr std::size_t capacity() { return N; };
+    // height of the tree
+    constexpr int         get_height() const { return nodes[root].height; };
+    // test of the ordering and of the balancing of every node
+    constexpr bool        validate() const;
+private:
+    // node of the tree, children are indices into the node array
+    struct StaticNode
+    {
+        T             key {};
+        std::uint32_t left   = none;
+        std::uint32_t right  = none;
+        int           height = 0;
+    };
+    static constexpr std::uint32_t none = UINT32_MAX;
+    // private helper functions
+    static constexpr void sort(T (&keys)[N]);
+    constexpr std::uint32_t build(std::uint32_t first, std::uint32_t last);
+    StaticNode    nodes[N];
+    std::uint32_t count;
+    std::uint32_t root;
+};
+
+// deduce the key type and the capacity from the array of keys
+template<class T, std::size_t N>
+StaticAVLTree(const T (&)[N]) -> StaticAVLTree<T, N>;
+
+// sort the keys, drop the duplicates and build the tree over them. The nodes
+// are stored in ascending key order
+// precondition: none
+// postcondition: balanced tree containing the distinct keys
+template <class T, std::size_t N>
+constexpr StaticAVLTree<T,N>::StaticAVLTree(const T (&keys)[N]) : nodes(), count(0), root(0)
+{
+    T sorted[N] {};
+    for (std::size_t k = 0; k < N; k++)
+        sorted[k] = keys[k];
+    sort(sorted);
+    
+    for (std::size_t k = 0; k < N; k++)
+        if (count == 0 || nodes[count - 1].key < sorted[k])
+            nodes[count++].key = sorted[k];
+    
+    root = build(0, count);
+}
+
+// find a key in the tree
+// precondition: none
+// postcondition: return the pointer to the key if the key is found,
+// otherwise return a nullptr if the key is not found
+template <class T, std::size_t N>
+constexpr const T* StaticAVLTree<T,N>::find(const T& key) const
+{
+    std::uint32_t index = root;
+    
+    // tree traversal
+    while (index != none)
+    {
+        const StaticNode& node = nodes[index];
+        if (key > node.key)
+            index = node.right;
+        else if (key < node.key)
+            index = node.left;
+        else
+        // key found!
+            return &node.key;
+    }
+    
+    return nullptr;
+}
+
+// collect the keys in the closed interval [low,high]; the nodes are in key
+// order, so the range is located by one descent and copied
+// precondition: none
+// postcondition: the keys found are appended to the vector in ascending order
+template <class T, std::size_t N>
+void StaticAVLTree<T,N>::find_range(const T& low, const T& high, std::vector<T>& keys) const
+{
+    // first node not less than low
+    std::uint32_t first = count;
+    std::uint32_t index = root;
+    while (index != none)
+    {
+        if (nodes[index].key < low)
+            index = nodes[index].right;
+        else
+        {
+            first = index;
+            index = nodes[index].left;
+        }
+    }
+    
+    for (std::uint32_t k = first; k < count && !(nodes[k].key > high); k++)
+        keys.push_back(nodes[k].key);
+}
+
+// check that the keys are ordered and every node is balanced
+// precondition: none
+// postcondition: return true if the tree is consistent, false otherwise
+template <class T, std::size_t N>
+constexpr bool StaticAVLTree<T,N>::validate() const
+{
+    for (std::uint32_t k = 0; k < count; k++)
+    {
+        const StaticNode& node = nodes[k];
+        int left_height  = node.left  == none ? 0 : nodes[node.left].height;
+        int right_height = node.right == none ? 0 : nodes[node.right].height;
+        
+        if (node.height != (left_height > right_height ? left_height : right_height) + 1 ||
+            left_height - right_height > 1 || right_height - left_height > 1)
+            return false;
+        
+        // in-order neighbours are adjacent in the array
+        if (k > 0 && !(nodes[k - 1].key < node.key))
+            return false;
+        if (node.left != none && !(node.left < k))
+            return false;
+        if (node.right != none && !(node.right > k))
+            return false;
+    }
+    
+    return true;
+}
+
+// heap sort, which unlike the standard algorithms is usable in constant
+// expressions in C++17 and keeps the evaluation within O(n log n) steps
+// precondition: none
+// postcondition: keys in ascending order
+template <class T, std::size_t N>
+constexpr void StaticAVLTree<T,N>::sort(T (&keys)[N])
+{
+    // move the key at index down the heap of the given size
+    auto sift_down = [&keys](std::size_t index, std::size_t size)
+    {
+        while (2 * index + 1 < size)
+        {
+            std::size_t child = 2 * index + 1;
+            if (child + 1 < size && keys[child] < keys[child + 1])
+                child++;
+            if (!(keys[index] < keys[child]))
+                return;
+            T key       = keys[index];
+            keys[index] = keys[child];
+            keys[child] = key;
+            index       = child;
+        }
+    };
+    
+    for (std::size_t k = N / 2; k > 0; k--)
+        sift_down(k - 1, N);
+    for (std::size_t size = N - 1; size > 0; size--)
+    {
+        T key      = keys[0];
+        keys[0]    = keys[size];
+        keys[size] = key;
+        sift_down(0, size);
+    }
+}
+
+// link the nodes in [first,last) into a balanced subtree rooted at the
+// middle node
+// precondition: first not greater than last
+// postcondition: return the index of the subtree root, none if empty
+template <class T, std::size_t N>
+constexpr std::uint32_t StaticAVLTree<T,N>::build(std::uint32_t first, std::uint32_t last)
+{
+    if (first == last)
+        return none;
+    
+    std::uint32_t middle = first + (last - first) / 2;
+    StaticNode& node = nodes[middle];
+    node.left  = build(first, middle);
+    node.right = build(middle + 1, last);
+    
+    int left_height  = node.left  == none ? 0 : nodes[node.left].height;
+    int right_height = node.right == none ? 0 : nodes[node.right].height;
+    node.height = (left_height > right_height ? left_height : right_height) + 1;
+    
+    return middle;
+}
+
+}
+#endif /* StaticAVLTree_h */
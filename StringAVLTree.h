@@ -0,0 +1,308 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef StringAVLTree_h
+#define StringAVLTree_h
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "AVLTree.h"
+
+namespace mathsophy
+{
+
+// String key stored out of the node: the bytes are kept in the arena of the
+// tree and the node only holds their address and length. Keys are ordered
+// byte-wise as unsigned chars, a prefix coming before its extensions.
+struct AVLStringKey
+{
+    // ordering of the keys
+    bool operator<(const AVLStringKey& key) const { return compare(key) < 0; };
+    bool operator>(const AVLStringKey& key) const { return compare(key) > 0; };
+    int  compare(const AVLStringKey& key) const
+    {
+        int order = std::memcmp(data, key.data, length < key.length ? length : key.length);
+        if (order != 0)
+            return order;
+        return (length < key.length) ? -1 : (length > key.length);
+    };
+    const char*   data;
+    std::uint32_t length;
+};
+
+// Descent of a string key keeping the length of the common prefix with the
+// nearest ancestors it is smaller and greater than: every key of the current
+// subtree lies between these two ancestors and shares at least the shorter of
+// the two prefixes with the searched key, so the comparison at each level
+// starts after it and the shared bytes are scanned once along the path
+// instead of once per level. Used by the insertions and removals of the tree
+// as well as by the lookups.
+template<>
+class AVLKeySearch<AVLStringKey>
+{
+public:
+    // constructor
+    explicit AVLKeySearch(const AVLStringKey& k) : key(k), low(0), high(0) { };
+    // order of the searched key with respect to the key of the next node
+    int         compare(const AVLStringKey& current);
+private:
+    static std::size_t common_prefix(const char* a, const char* b, std::size_t from, std::size_t length);
+    const AVLStringKey& key;
+    // common prefix lengths with the nearest smaller and greater ancestors
+    std::size_t low;
+    std::size_t high;
+};
+
+// AVL tree of strings sharing long prefixes, e.g. paths. The strings are
+// copied into a shared arena of large blocks instead of a heap allocation per
+// string next to the one of the node, and the nodes hold a 16 byte handle
+// instead of a std::string. Every descent skips the prefix already known to
+// match, see AVLKeySearch<AVLStringKey>, and an insertion or removal makes a
+// single one. The bytes of removed keys are reclaimed by copying the live
+// keys to a new arena once they exceed the live bytes.
+class StringAVLTree : protected AVLTree<AVLStringKey>
+{
+public:
+    // constructor
+    StringAVLTree() : large_bytes(0), used(0), live_bytes(0), dead_bytes(0) { };
+    StringAVLTree(const StringAVLTree&) = delete;
+    StringAVLTree& operator=(const StringAVLTree&) = delete;
+    // balanced insertion of a new string
+    void        insert(std::string_view key);
+    // test for a string
+    bool        find(std::string_view key) const { return search(key) != nullptr; };
+    // balanced removal of a string
+    void        remove(std::string_view key);
+    // number of strings
+    using AVLTree<AVLStringKey>::size;
+    // bytes taken by the tree, its nodes and the arena, every allocation
+    // charged with its heap chunk as by AVLTree::memory_usage
+    std::size_t memory() const { return memory_usage() + arena.size() * allocation_size(block_size) + large_bytes; };
+    // test of the tree structure
+    using AVLTree<AVLStringKey>::validate;
+    // test for balanced tree
+    using AVLTree<AVLStringKey>::is_balanced;
+    using AVLTree<AVLStringKey>::is_not_balanced;
+    // test for empty tree
+    using AVLTree<AVLStringKey>::is_empty;
+    using AVLTree<AVLStringKey>::is_not_empty;
+private:
+    typedef AVLTree<AVLStringKey> Base;
+    typedef AVLNode<AVLStringKey> Node;
+    static constexpr std::size_t block_size = 65536;
+    // private helper functions
+    Node*       search(std::string_view key) const;
+    const char* store(std::string_view key);
+    void        unstore(std::size_t length);
+    void        repack();
+    // blocks of the arena, the last one being filled, and the keys longer
+    // than a block, which get a block of their own
+    std::vector<std::unique_ptr<char[]>> arena;
+    std::vector<std::unique_ptr<char[]>> large;
+    // heap chunks of the large keys
+    std::size_t large_bytes;
+    std::size_t used;
+    std::size_t live_bytes;
+    std::size_t dead_bytes;
+};
+
+// order of the searched key with respect to the key of a node, the bytes
+// before the shorter of the two known prefixes being skipped
+// precondition: the nodes are given in the order of the descent
+// postcondition: return the sign of the comparison, the known prefix of
+// the side taken updated
+inline int AVLKeySearch<AVLStringKey>::compare(const AVLStringKey& current)
+{
+    std::size_t length = key.length < current.length ? key.length : current.length;
+    std::size_t k      = common_prefix(key.data, current.data, low < high ? low : high, length);
+    
+    int order;
+    if (k < length)
+        order = static_cast<unsigned char>(key.data[k]) > static_cast<unsigned char>(current.data[k]) ? 1 : -1;
+    else if (key.length != current.length)
+        order = key.length > current.length ? 1 : -1;
+    else
+    // key found!
+        return 0;
+    
+    if (order > 0)
+        low  = k;
+    else
+        high = k;
+    return order;
+}
+
+// length of the common prefix of two strings known to match up to from, the
+// bytes compared eight at a time
+// precondition: from not greater than length
+// postcondition: return the common prefix length, at most length
+inline std::size_t AVLKeySearch<AVLStringKey>::common_prefix(const char* a, const char* b, std::size_t from, std::size_t length)
+{
+    std::size_t k = from;
+    for (; k + 8 <= length; k += 8)
+    {
+        std::uint64_t x, y;
+        std::memcpy(&x, a + k, 8);
+        std::memcpy(&y, b + k, 8);
+        if (x != y)
+            break;
+    }
+    while (k < length && a[k] == b[k])
+        k++;
+    return k;
+}
+
+// insert a string, copied into the arena if not present yet. The copy is
+// made before the descent and taken back if the string is found
+// precondition: string shorter than 4 GB
+// postcondition: the string is in the tree
+inline void StringAVLTree::insert(std::string_view key)
+{
+    std::size_t before = size();
+    
+    const char* data = store(key);
+    Base::insert({ data, static_cast<std::uint32_t>(key.size()) });
+    
+    if (size() == before)
+        unstore(key.size());
+    else
+        live_bytes += key.size();
+}
+
+// remove a string, its bytes in the arena become garbage
+// precondition: none
+// postcondition: the string is not in the tree
+inline void StringAVLTree::remove(std::string_view key)
+{
+    std::size_t before = size();
+    
+    Base::remove({ key.data(), static_cast<std::uint32_t>(key.size()) });
+    if (size() == before)
+        return;
+    
+    live_bytes -= key.size();
+    dead_bytes += key.size();
+    
+    if (dead_bytes > live_bytes && dead_bytes > block_size)
+        repack();
+}
+
+// find the node of a string
+// precondition: none
+// postcondition: return the node of the string, nullptr if not found
+inline StringAVLTree::Node* StringAVLTree::search(std::string_view key) const
+{
+    AVLStringKey searched = { key.data(), static_cast<std::uint32_t>(key.size()) };
+    AVLKeySearch<AVLStringKey> search(searched);
+    Node* node = get_root();
+    
+    // tree traversal
+    while (node)
+    {
+        int order = search.compare(node_key(node));
+        if (order > 0)
+            node = node->get_right();
+        else if (order < 0)
+            node = node->get_left();
+        else
+        // key found!
+            return node;
+    }
+    
+    return nullptr;
+}
+
+// copy the bytes of a string into the arena
+// precondition: none
+// postcondition: return the address of the copy
+inline const char* StringAVLTree::store(std::string_view key)
+{
+    if (key.size() > block_size)
+    {
+        large.push_back(std::make_unique<char[]>(key.size()));
+        large_bytes += allocation_size(key.size());
+        std::memcpy(large.back().get(), key.data(), key.size());
+        return large.back().get();
+    }
+    
+    if (arena.empty() || used + key.size() > block_size)
+    {
+        arena.push_back(std::make_unique<char[]>(block_size));
+        used = 0;
+    }
+    
+    char* data = arena.back().get() + used;
+    std::memcpy(data, key.data(), key.size());
+    used += key.size();
+    
+    return data;
+}
+
+// take back the last copy made by store
+// precondition: no other copy made since
+// postcondition: the bytes of the copy are free again
+inline void StringAVLTree::unstore(std::size_t length)
+{
+    if (length > block_size)
+    {
+        large_bytes -= allocation_size(length);
+        large.pop_back();
+    }
+    else
+        used -= length;
+}
+
+// copy the live strings into a new arena in key order and point the nodes
+// to the copies
+// precondition: none
+// postcondition: no garbage left in the arena
+inline void StringAVLTree::repack()
+{
+    std::vector<std::unique_ptr<char[]>> old_arena;
+    std::vector<std::unique_ptr<char[]>> old_large;
+    old_arena.swap(arena);
+    old_large.swap(large);
+    large_bytes = 0;
+    used        = 0;
+    
+    // in-order traversal
+    std::vector<Node*> stack;
+    Node* node = get_root();
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        node = stack.back();
+        stack.pop_back();
+        
+        AVLStringKey& key = node_key(node);
+        key.data = store({ key.data, key.length });
+        
+        node = node->get_right();
+    }
+    
+    dead_bytes = 0;
+}
+
+}
+#endif /* StringAVLTree_h */
@@ -0,0 +1,431 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstdlib>
+#include "AVLTree.h"
+#include "StringAVLTree.h"
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+using mathsophy::AVLTree;
+using mathsophy::AVLNode;
+using mathsophy::FrozenAVLTree;
+using mathsophy::EytzingerIndex;
+using mathsophy::StringAVLTree;
+
+// private functions ----------------------
+
+// hardware counters of a measured section
+struct Counters
+{
+    double        seconds;
+    long long     cache_misses;
+    long long     tlb_misses;
+};
+
+// open a hardware counter for the calling thread, -1 if not available
+static int open_counter(std::uint32_t type, std::uint64_t config);
+
+// read and close a hardware counter, -1 if not available
+static long long close_counter(int fd);
+
+// n-th distinct key of the benchmark, unique for n < 2^32
+static unsigned int benchmark_key(std::uint64_t n);
+
+// measure the lookups of the given keys with the given find function
+template <class F>
+static Counters measure_lookups(const std::vector<unsigned int>& queries, F find);
+
+// benchmark the pointer based tree against its read-only layouts
+static void lookup_benchmark(std::uint64_t number_keys, std::uint64_t number_queries);
+
+// benchmark a churned tree before and after the compaction of its nodes
+static void churn_benchmark(std::uint64_t number_keys, std::uint64_t number_queries);
+
+// benchmark path-like string keys in AVLTree<std::string> and StringAVLTree
+static void string_benchmark(std::uint64_t number_keys, std::uint64_t number_queries);
+
+// n-th distinct path-like key of the string benchmark
+static std::string benchmark_path(std::uint64_t n);
+
+// in-order scan of all the keys, return their sum
+static std::uint64_t scan(const AVLTree<unsigned int>& tree);
+
+// main -----------------------------------
+
+// usage: benchmark [number of keys]...
+// default sizes are 1M and 100M keys, pass 1000000000 for 1B keys
+int main(int argc, const char * argv[])
+{
+    constexpr std::uint64_t number_queries = 10000000;
+    std::vector<std::uint64_t> sizes;
+    
+    for (int k = 1; k < argc; k++)
+        sizes.push_back(std::strtoull(argv[k], nullptr, 10));
+    if (sizes.empty())
+        sizes = { 1000000, 100000000 };
+    
+    for (std::uint64_t size : sizes)
+        lookup_benchmark(size, number_queries);
+    
+    // the churn takes three rounds of updates, limit it to moderate sizes
+    for (std::uint64_t size : sizes)
+        if (size <= 10000000)
+            churn_benchmark(size, number_queries);
+    
+    for (std::uint64_t size : sizes)
+        if (size <= 10000000)
+            string_benchmark(size, number_queries);
+    
+    return 0;
+}
+
+// private functions implementation
+
+// benchmark random lookups of present keys in the pointer based tree, in
+// its van Emde Boas snapshot and in its Eytzinger index, reporting latency
+// and miss counters
+// precondition: number of keys less than 2^31
+// postcondition: results printed on standard output
+void lookup_benchmark(std::uint64_t number_keys, std::uint64_t number_queries)
+{
+    AVLTree<unsigned int> tree;
+    
+    for (std::uint64_t n = 0; n < number_keys; n++)
+        tree.insert(benchmark_key(n));
+    
+    FrozenAVLTree<unsigned int> frozen    = tree.freeze();
+    EytzingerIndex<unsigned int> eytzinger = tree.export_eytzinger();
+    
+    // seeded queries for reproducible runs
+    std::mt19937_64 gen(number_keys);
+    std::uniform_int_distribution<std::uint64_t> distr(0, number_keys - 1);
+    std::vector<unsigned int> queries(number_queries);
+    for (unsigned int& query : queries)
+        query = benchmark_key(distr(gen));
+    
+    Counters pointer = measure_lookups(queries, [&tree](unsigned int key) { return tree.find(key) != nullptr; });
+    Counters layout  = measure_lookups(queries, [&frozen](unsigned int key) { return frozen.find(key) != nullptr; });
+    Counters bfs     = measure_lookups(queries, [&eytzinger](unsigned int key) { return eytzinger.find(key) != nullptr; });
+    
+    // batched lookups of the same queries, one batch per measured call,
+    // the totals are reported per key
+    constexpr std::size_t batch_size = 256;
+    std::vector<unsigned int> batch(batch_size);
+    std::vector<unsigned int> batch_queries;
+    for (std::size_t k = 0; k + batch_size <= queries.size(); k += batch_size)
+        batch_queries.push_back(static_cast<unsigned int>(k));
+    
+    std::vector<AVLNode<unsigned int>*> nodes;
+    Counters pointer_batch = measure_lookups(batch_queries, [&](unsigned int first)
+    {
+        std::copy(queries.begin() + first, queries.begin() + first + batch_size, batch.begin());
+        tree.find_batch(batch, nodes);
+        return std::count(nodes.begin(), nodes.end(), nullptr) == 0;
+    });
+    
+    std::vector<const unsigned int*> results;
+    Counters bfs_batch = measure_lookups(batch_queries, [&](unsigned int first)
+    {
+        std::copy(queries.begin() + first, queries.begin() + first + batch_size, batch.begin());
+        eytzinger.find_batch(batch, results);
+        return std::count(results.begin(), results.end(), nullptr) == 0;
+    });
+    
+    auto report = [number_queries](const char* name, const Counters& c)
+    {
+        std::cout << "  " << std::left << std::setw(10) << name << std::right
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(10) << 1e9 * c.seconds / number_queries << " ns/find";
+        if (c.cache_misses >= 0)
+            std::cout << std::setw(10) << double(c.cache_misses) / number_queries << " cache misses/find";
+        if (c.tlb_misses >= 0)
+            std::cout << std::setw(10) << double(c.tlb_misses) / number_queries << " dTLB misses/find";
+        std::cout << "\n";
+    };
+    
+    std::cout << "Random lookups, " << number_keys << " keys, " << number_queries << " queries\n";
+    report("pointer", pointer);
+    report("ptr.batch", pointer_batch);
+    report("frozen", layout);
+    report("eytzinger", bfs);
+    report("eyt.batch", bfs_batch);
+    std::cout << std::endl;
+}
+
+// age a tree by replacing its keys several times over with unrelated
+// allocations in between, so that neighbouring nodes end up far apart in the
+// heap, then compare random lookups and full in-order scans before and after
+// compact() and against a compaction done by compact_incremental() slices
+// precondition: number of keys less than 2^31
+// postcondition: results printed on standard output
+void churn_benchmark(std::uint64_t number_keys, std::uint64_t number_queries)
+{
+    using Clock = std::chrono::steady_clock;
+    AVLTree<unsigned int> tree;
+    
+    for (std::uint64_t n = 0; n < number_keys; n++)
+        tree.insert(benchmark_key(n));
+    
+    // remove and insert random keys, the live keys staying 0..number_keys-1
+    // shifted by a growing offset, with a ballast allocation per operation
+    std::mt19937_64 gen(number_keys);
+    std::vector<std::uint64_t> live(number_keys);
+    for (std::uint64_t n = 0; n < number_keys; n++)
+        live[n] = n;
+    std::vector<std::vector<char>> ballast;
+    std::uint64_t next = number_keys;
+    for (std::uint64_t k = 0; k < 3 * number_keys; k++)
+    {
+        std::uint64_t slot = gen() % number_keys;
+        tree.remove(benchmark_key(live[slot]));
+        ballast.emplace_back(16 + gen() % 64);
+        live[slot] = next++;
+        tree.insert(benchmark_key(live[slot]));
+        if (ballast.size() > number_keys / 4)
+        {
+            std::swap(ballast[gen() % ballast.size()], ballast.back());
+            ballast.pop_back();
+        }
+    }
+    
+    std::vector<unsigned int> queries(number_queries);
+    for (unsigned int& query : queries)
+        query = benchmark_key(live[gen() % number_keys]);
+    
+    auto measure_scans = [&tree]()
+    {
+        constexpr int scans = 5;
+        std::uint64_t sum = 0;
+        auto start = Clock::now();
+        for (int k = 0; k < scans; k++)
+            sum += scan(tree);
+        auto stop  = Clock::now();
+        if (sum == 0)
+            std::cerr << "-> scan failure\n";
+        return 1e9 * std::chrono::duration<double>(stop - start).count() / (scans * double(tree.size()));
+    };
+    
+    auto find = [&tree](unsigned int key) { return tree.find(key) != nullptr; };
+    
+    Counters churned    = measure_lookups(queries, find);
+    double churned_scan = measure_scans();
+    
+    AVLTree<unsigned int> copy;
+    copy = tree;
+    auto start = Clock::now();
+    tree.compact();
+    double compact_time = std::chrono::duration<double>(Clock::now() - start).count();
+    Counters compacted    = measure_lookups(queries, find);
+    double compacted_scan = measure_scans();
+    
+    // the same compaction by 100 microsecond slices
+    std::size_t slices = 1;
+    start = Clock::now();
+    while ( !copy.compact_incremental(std::chrono::microseconds(100)) )
+        slices++;
+    double incremental_time = std::chrono::duration<double>(Clock::now() - start).count();
+    
+    std::cout << "Churned tree, " << number_keys << " keys, " << number_queries << " queries\n"
+              << std::fixed << std::setprecision(1)
+              << "  churned   " << std::setw(10) << 1e9 * churned.seconds / number_queries << " ns/find"
+              << std::setw(10) << churned_scan << " ns/key scanned\n"
+              << "  compacted " << std::setw(10) << 1e9 * compacted.seconds / number_queries << " ns/find"
+              << std::setw(10) << compacted_scan << " ns/key scanned\n"
+              << std::setprecision(3)
+              << "  compact() " << compact_time << " s, compact_incremental() "
+              << incremental_time << " s in " << slices << " slices\n";
+    std::cout << std::endl;
+}
+
+// random lookups of present path-like keys, sharing long prefixes, in a tree
+// of std::string and in a StringAVLTree, which skips the prefix known to match
+// at each level, with the memory taken by the nodes and the key bytes
+// precondition: number of keys less than 2^32
+// postcondition: results printed on standard output
+void string_benchmark(std::uint64_t number_keys, std::uint64_t number_queries)
+{
+    AVLTree<std::string> tree;
+    StringAVLTree strings;
+    
+    for (std::uint64_t n = 0; n < number_keys; n++)
+    {
+        std::string path = benchmark_path(n);
+        tree.insert(path);
+        strings.insert(path);
+    }
+    
+    std::mt19937_64 gen(number_keys);
+    std::uniform_int_distribution<std::uint64_t> distr(0, number_keys - 1);
+    std::vector<std::string> paths(1 << 16);
+    for (std::string& path : paths)
+        path = benchmark_path(distr(gen));
+    std::vector<unsigned int> queries(number_queries);
+    for (unsigned int& query : queries)
+        query = static_cast<unsigned int>(gen() % paths.size());
+    
+    Counters plain      = measure_lookups(queries, [&](unsigned int k) { return tree.find(paths[k]) != nullptr; });
+    Counters compressed = measure_lookups(queries, [&](unsigned int k) { return strings.find(paths[k]); });
+    
+    // both charge every allocation with its heap chunk
+    std::size_t plain_memory = tree.memory_usage();
+    std::cout << "Path keys, " << number_keys << " keys, " << number_queries << " queries\n"
+              << std::fixed << std::setprecision(1)
+              << "  std::string " << std::setw(10) << 1e9 * plain.seconds / number_queries << " ns/find"
+              << std::setw(10) << double(plain_memory) / number_keys << " bytes/key\n"
+              << "  StringAVL   " << std::setw(10) << 1e9 * compressed.seconds / number_queries << " ns/find"
+              << std::setw(10) << double(strings.memory()) / number_keys << " bytes/key\n";
+    std::cout << std::endl;
+}
+
+// path of a file in a deep directory hierarchy, the nearby keys sharing all
+// but their last components
+// precondition: none
+// postcondition: return the n-th benchmark path
+std::string benchmark_path(std::uint64_t n)
+{
+    unsigned int key = benchmark_key(n);
+    return "/srv/storage/projects/repository/src/module" + std::to_string(key >> 24) +
+           "/package" + std::to_string((key >> 16) & 0xff) + "/file" + std::to_string(key & 0xffff) + ".cpp";
+}
+
+// sum the keys by an in-order traversal, following the node links
+// precondition: none
+// postcondition: return the sum of the keys
+std::uint64_t scan(const AVLTree<unsigned int>& tree)
+{
+    std::uint64_t sum = 0;
+    std::vector<const AVLNode<unsigned int>*> stack;
+    const AVLNode<unsigned int>* node = tree.get_root();
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        node = stack.back();
+        stack.pop_back();
+        sum += node->get_key();
+        node = node->get_right();
+    }
+    return sum;
+}
+
+// measure the lookups of the given keys
+// precondition: valid find function is given
+// postcondition: return elapsed time and miss counters, counters are
+// negative if the hardware counters are not available
+template <class F>
+Counters measure_lookups(const std::vector<unsigned int>& queries, F find)
+{
+#ifdef __linux__
+    int cache_fd = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    int tlb_fd   = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+#else
+    int cache_fd = -1;
+    int tlb_fd   = -1;
+#endif
+    std::uint64_t found = 0;
+    
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int key : queries)
+        found += find(key);
+    auto stop  = std::chrono::steady_clock::now();
+    
+    Counters c;
+    c.seconds      = std::chrono::duration<double>(stop - start).count();
+    c.cache_misses = close_counter(cache_fd);
+    c.tlb_misses   = close_counter(tlb_fd);
+    
+    // keep the lookups from being optimized away
+    if (found != queries.size())
+        std::cerr << "-> lookup failure: " << queries.size() - found << " keys not found\n";
+    
+    return c;
+}
+
+// open a hardware counter by means of perf_event_open
+// precondition: none
+// postcondition: return the enabled counter descriptor, -1 if not available
+int open_counter(std::uint32_t type, std::uint64_t config)
+{
+#ifdef __linux__
+    perf_event_attr attr {};
+    attr.size           = sizeof(attr);
+    attr.type           = type;
+    attr.config         = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    
+    int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    if (fd >= 0)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return fd;
+#else
+    (void)type;
+    (void)config;
+    return -1;
+#endif
+}
+
+// read and close a hardware counter
+// precondition: none
+// postcondition: return the counter value, -1 if not available
+long long close_counter(int fd)
+{
+    long long value = -1;
+#ifdef __linux__
+    if (fd < 0)
+        return value;
+    
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+        value = -1;
+    close(fd);
+#else
+    (void)fd;
+#endif
+    return value;
+}
+
+// multiplication by an odd constant is a bijection on 32 bit integers,
+// so the first 2^32 keys are distinct and spread over the whole range
+// precondition: none
+// postcondition: return the n-th benchmark key
+unsigned int benchmark_key(std::uint64_t n)
+{
+    return static_cast<unsigned int>(n * 2654435761u);
+}
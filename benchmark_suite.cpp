@@ -0,0 +1,455 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "AVLTree.h"
+
+using mathsophy::AVLTree;
+using mathsophy::AVLBalance;
+using mathsophy::WAVLBalance;
+using mathsophy::AVLTreeStats;
+
+// private types --------------------------
+
+// order and popularity of the keys of a workload
+enum Pattern { sequential, uniform, zipfian };
+
+// operations of the workloads, precomputed so that the generation of the
+// keys is not measured. The keys present in the structure are the even
+// numbers below twice the size, the odd numbers are never present.
+struct Workload
+{
+    std::vector<unsigned int>  insert_keys;
+    std::vector<unsigned int>  hit_keys;
+    std::vector<unsigned int>  miss_keys;
+    std::vector<unsigned int>  remove_keys;
+    // mixed workload: half lookups, a quarter insertions and removals each,
+    // over the even and odd numbers so that the size stays about the same
+    std::vector<unsigned int>  mixed_keys;
+    std::vector<std::uint8_t>  mixed_operations;
+};
+
+// elapsed time and latency samples of a measured phase
+struct Result
+{
+    std::uint64_t              operations = 0;
+    double                     seconds    = 0;
+    std::vector<std::uint32_t> samples;
+    // tree rotations, counted with AVLTREE_STATS only
+    bool                       counted    = false;
+    std::uint64_t              rotations  = 0;
+};
+
+// Zipfian ranks in [0,n[ with exponent theta, by the method of Gray et al.
+// used by YCSB: O(n) setup, O(1) memory and time per rank
+class Zipf
+{
+public:
+    Zipf(std::uint64_t n, double theta = 0.99);
+    std::uint64_t operator()(std::mt19937_64& gen);
+private:
+    std::uint64_t n;
+    double        theta;
+    double        alpha;
+    double        zetan;
+    double        eta;
+};
+
+// AVLTree with the given balancing policy and balanced or unbalanced
+// insertion and removal
+template<class P>
+class TreeStructure
+{
+public:
+    TreeStructure(bool balanced) : balanced(balanced) { };
+    void        insert(unsigned int key) { if (balanced) tree.insert(key); else tree.unbalanced_insert(key); };
+    bool        find(unsigned int key) { return tree.find(key) != nullptr; };
+    void        remove(unsigned int key) { if (balanced) tree.remove(key); else tree.unbalanced_remove(key); };
+    // rotations since the last call
+    static constexpr bool counts_rotations = true;
+    std::uint64_t rotations()
+    {
+        AVLTreeStats stats = tree.stats();
+        tree.reset_stats();
+        return stats.rotations_left + stats.rotations_right + stats.rotations_left_right + stats.rotations_right_left;
+    };
+protected:
+    AVLTree<unsigned int, P> tree;
+    bool                     balanced;
+};
+
+// AVLTree serving the lookups from a hash index of its nodes
+class HashTreeStructure : public TreeStructure<AVLBalance>
+{
+public:
+    HashTreeStructure(bool balanced) : TreeStructure<AVLBalance>(balanced) { tree.set_hash_mode(true); };
+};
+
+// AVLTree serving the lookups of the hot keys from a cache of their nodes
+class CacheTreeStructure : public TreeStructure<AVLBalance>
+{
+public:
+    CacheTreeStructure(bool balanced) : TreeStructure<AVLBalance>(balanced) { tree.set_cache_mode(true, 4096); };
+};
+
+// std::set baseline
+class SetStructure
+{
+public:
+    SetStructure(bool) { };
+    void        insert(unsigned int key) { (void)keys.insert(key); };
+    bool        find(unsigned int key) { return keys.find(key) != keys.end(); };
+    void        remove(unsigned int key) { (void)keys.erase(key); };
+    static constexpr bool counts_rotations = false;
+    std::uint64_t rotations() { return 0; };
+private:
+    std::set<unsigned int> keys;
+};
+
+// std::map baseline
+class MapStructure
+{
+public:
+    MapStructure(bool) { };
+    void        insert(unsigned int key) { (void)keys.emplace(key, key); };
+    bool        find(unsigned int key) { return keys.find(key) != keys.end(); };
+    void        remove(unsigned int key) { (void)keys.erase(key); };
+    static constexpr bool counts_rotations = false;
+    std::uint64_t rotations() { return 0; };
+private:
+    std::map<unsigned int, unsigned int> keys;
+};
+
+// private functions ----------------------
+
+// operations per measured phase, phases of small structures are repeated
+static constexpr std::uint64_t phase_operations = 1000000;
+
+// one operation out of this many is timed on its own for the percentiles
+static constexpr std::uint64_t sample_stride    = 32;
+
+// generate the workloads of a structure size and key pattern
+static void generate_workload(std::uint64_t size, Pattern pattern, std::uint64_t seed, Workload& workload);
+
+// keys visited in the given pattern, as indices below the given range
+static void generate_indices(std::uint64_t range, std::uint64_t count, Pattern pattern,
+                             std::mt19937_64& gen, std::vector<unsigned int>& indices);
+
+// run all the workloads on one kind of structure
+template <class S>
+static void run_structure(const char* name, bool balanced, const Workload& workload);
+
+// measure a phase of count operations
+template <class F>
+static void measure(std::uint64_t count, F operation, Result& result);
+
+// print throughput and latency percentiles of a phase, and the rotations
+// per operation when they are counted
+static void report(const char* structure, const char* phase, Result& result);
+
+// main -----------------------------------
+
+// usage: benchmark_suite [--seed n] [size]...
+// default sizes are 1K to 1M keys, pass 10000000 100000000 for larger trees
+int main(int argc, const char * argv[])
+{
+    std::uint64_t seed = 1;
+    std::vector<std::uint64_t> sizes;
+    
+    for (int k = 1; k < argc; k++)
+    {
+        if (std::strcmp(argv[k], "--seed") == 0 && k + 1 < argc)
+            seed = std::strtoull(argv[++k], nullptr, 10);
+        else
+            sizes.push_back(std::strtoull(argv[k], nullptr, 10));
+    }
+    if (sizes.empty())
+        sizes = { 1000, 10000, 100000, 1000000 };
+    
+    const char* pattern_names[] = { "sequential", "uniform", "zipfian" };
+    
+    std::cout << "Benchmark suite, seed " << seed << "\n";
+    
+    for (std::uint64_t size : sizes)
+        for (Pattern pattern : { sequential, uniform, zipfian })
+        {
+            Workload workload;
+            generate_workload(size, pattern, seed, workload);
+            
+            std::cout << "\n" << size << " keys, " << pattern_names[pattern] << " keys\n";
+            std::cout << "  " << std::left << std::setw(12) << "structure" << std::setw(10) << "phase" << std::right
+                      << std::setw(10) << "Mops/s" << std::setw(9) << "p50" << std::setw(9) << "p90"
+                      << std::setw(9) << "p99" << std::setw(9) << "p99.9" << " ns";
+#ifdef AVLTREE_STATS
+            std::cout << "  rotations/op";
+#endif
+            std::cout << "\n";
+            
+            run_structure<TreeStructure<AVLBalance>>("avl", true, workload);
+            run_structure<TreeStructure<WAVLBalance>>("wavl", true, workload);
+            run_structure<HashTreeStructure>("avl.hash", true, workload);
+            run_structure<CacheTreeStructure>("avl.cache", true, workload);
+            // unbalanced insertion of sorted keys builds a list, quadratic in the size
+            if (pattern != sequential || size <= 1000)
+                run_structure<TreeStructure<AVLBalance>>("avl.unbal", false, workload);
+            else
+                std::cout << "  " << std::left << std::setw(12) << "avl.unbal" << "skipped, degenerate tree\n" << std::right;
+            run_structure<SetStructure>("std::set", false, workload);
+            run_structure<MapStructure>("std::map", false, workload);
+        }
+    
+    return 0;
+}
+
+// private functions implementation
+
+// precompute the keys of the workloads. Sequential keys are visited in
+// ascending order, uniform keys in random order. Zipfian lookups and mixed
+// operations favour a few hot keys spread over the key range, Zipfian
+// insertions and removals visit every key once in random order.
+// precondition: size less than 2^31
+// postcondition: workload filled, the same seed gives the same workload
+void generate_workload(std::uint64_t size, Pattern pattern, std::uint64_t seed, Workload& workload)
+{
+    std::mt19937_64 gen(seed * 1000003 + size * 3 + pattern);
+    std::uint64_t queries = std::max(size, phase_operations);
+    
+    // every key inserted and removed once
+    workload.insert_keys.resize(size);
+    for (std::uint64_t k = 0; k < size; k++)
+        workload.insert_keys[k] = static_cast<unsigned int>(2 * k);
+    workload.remove_keys = workload.insert_keys;
+    if (pattern != sequential)
+    {
+        std::shuffle(workload.insert_keys.begin(), workload.insert_keys.end(), gen);
+        std::shuffle(workload.remove_keys.begin(), workload.remove_keys.end(), gen);
+    }
+    
+    // lookups of present and absent keys
+    generate_indices(size, queries, pattern, gen, workload.hit_keys);
+    workload.miss_keys.resize(queries);
+    for (std::uint64_t k = 0; k < queries; k++)
+    {
+        workload.hit_keys[k] *= 2;
+        workload.miss_keys[k] = workload.hit_keys[k] + 1;
+    }
+    
+    // mixed operations over the even and odd keys
+    generate_indices(2 * size, queries, pattern, gen, workload.mixed_keys);
+    std::uniform_int_distribution<int> operation(0, 3);
+    workload.mixed_operations.resize(queries);
+    for (std::uint8_t& o : workload.mixed_operations)
+        o = static_cast<std::uint8_t>(operation(gen));
+}
+
+// generate indices below a range following a key pattern, the Zipfian
+// ranks are mapped to indices by a random permutation
+// precondition: positive range
+// postcondition: indices holds count indices
+void generate_indices(std::uint64_t range, std::uint64_t count, Pattern pattern,
+                      std::mt19937_64& gen, std::vector<unsigned int>& indices)
+{
+    indices.resize(count);
+    
+    if (pattern == sequential)
+    {
+        for (std::uint64_t k = 0; k < count; k++)
+            indices[k] = static_cast<unsigned int>(k % range);
+    }
+    else if (pattern == uniform)
+    {
+        std::uniform_int_distribution<std::uint64_t> distr(0, range - 1);
+        for (unsigned int& index : indices)
+            index = static_cast<unsigned int>(distr(gen));
+    }
+    else
+    {
+        std::vector<unsigned int> permutation(range);
+        for (std::uint64_t k = 0; k < range; k++)
+            permutation[k] = static_cast<unsigned int>(k);
+        std::shuffle(permutation.begin(), permutation.end(), gen);
+        
+        Zipf zipf(range);
+        for (unsigned int& index : indices)
+            index = permutation[zipf(gen)];
+    }
+}
+
+// run the phases of the workload on a structure: insertion of all the keys,
+// lookups of present and absent keys, removal of all the keys, and mixed
+// operations on a structure filled again. Insertion and removal are repeated
+// on new structures until enough operations are measured.
+// precondition: valid workload
+// postcondition: results printed on standard output
+template <class S>
+void run_structure(const char* name, bool balanced, const Workload& workload)
+{
+    const std::vector<unsigned int>& insert_keys = workload.insert_keys;
+    const std::vector<unsigned int>& remove_keys = workload.remove_keys;
+    std::uint64_t size   = insert_keys.size();
+    std::uint64_t rounds = std::max<std::uint64_t>(1, phase_operations / std::max<std::uint64_t>(size, 1));
+    Result insert, hit, miss, remove, mixed;
+    
+    for (std::uint64_t round = 0; round < rounds; round++)
+    {
+        S structure(balanced);
+        
+        measure(size, [&](std::uint64_t k) { structure.insert(insert_keys[k]); return true; }, insert);
+        insert.rotations += structure.rotations();
+        
+        if (round == rounds - 1)
+        {
+            measure(workload.hit_keys.size(), [&](std::uint64_t k) { return structure.find(workload.hit_keys[k]); }, hit);
+            measure(workload.miss_keys.size(), [&](std::uint64_t k) { return structure.find(workload.miss_keys[k]); }, miss);
+        }
+        
+        measure(size, [&](std::uint64_t k) { structure.remove(remove_keys[k]); return true; }, remove);
+        remove.rotations += structure.rotations();
+    }
+    
+    {
+        S structure(balanced);
+        for (unsigned int key : insert_keys)
+            structure.insert(key);
+        (void)structure.rotations();
+        
+        measure(workload.mixed_keys.size(), [&](std::uint64_t k)
+        {
+            unsigned int key = workload.mixed_keys[k];
+            switch (workload.mixed_operations[k])
+            {
+                case 2:  structure.insert(key); return true;
+                case 3:  structure.remove(key); return true;
+                default: return structure.find(key);
+            }
+        }, mixed);
+        mixed.rotations += structure.rotations();
+    }
+    
+    for (Result* result : { &insert, &hit, &miss, &remove, &mixed })
+        result->counted = S::counts_rotations;
+    
+    report(name, "insert", insert);
+    report(name, "find.hit", hit);
+    report(name, "find.miss", miss);
+    report(name, "remove", remove);
+    report(name, "mixed", mixed);
+}
+
+// measure a phase. The whole phase is timed for the throughput, one
+// operation out of sample_stride is also timed on its own for the latency
+// precondition: the operation returns a value depending on its result
+// postcondition: elapsed time, operations and samples added to the result
+template <class F>
+void measure(std::uint64_t count, F operation, Result& result)
+{
+    using Clock = std::chrono::steady_clock;
+    std::uint64_t sink = 0;
+    
+    auto start = Clock::now();
+    for (std::uint64_t k = 0; k < count; k++)
+    {
+        if (k % sample_stride == 0)
+        {
+            auto before = Clock::now();
+            sink += operation(k);
+            auto after  = Clock::now();
+            result.samples.push_back(static_cast<std::uint32_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count()));
+        }
+        else
+            sink += operation(k);
+    }
+    auto stop  = Clock::now();
+    
+    result.seconds    += std::chrono::duration<double>(stop - start).count();
+    result.operations += count;
+    
+    // keep the operations from being optimized away
+    if (sink > count)
+        std::cerr << "-> inconsistent result count\n";
+}
+
+// print a result line
+// precondition: none
+// postcondition: result printed on standard output, samples sorted
+void report(const char* structure, const char* phase, Result& result)
+{
+    std::vector<std::uint32_t>& samples = result.samples;
+    std::sort(samples.begin(), samples.end());
+    
+    auto percentile = [&samples](double p) -> std::uint32_t
+    {
+        if (samples.empty())
+            return 0;
+        return samples[std::min(samples.size() - 1, static_cast<std::size_t>(p * samples.size()))];
+    };
+    
+    double throughput = result.seconds > 0 ? result.operations / result.seconds / 1e6 : 0;
+    
+    std::cout << "  " << std::left << std::setw(12) << structure << std::setw(10) << phase << std::right
+              << std::fixed << std::setprecision(2) << std::setw(10) << throughput
+              << std::setw(9) << percentile(0.5) << std::setw(9) << percentile(0.9)
+              << std::setw(9) << percentile(0.99) << std::setw(9) << percentile(0.999);
+#ifdef AVLTREE_STATS
+    if (result.counted && result.operations > 0)
+        std::cout << std::setw(10) << std::setprecision(3) << double(result.rotations) / result.operations;
+#endif
+    std::cout << "\n";
+}
+
+// set up the Zipfian generator
+// precondition: positive n, theta in ]0,1[
+// postcondition: generator ready
+Zipf::Zipf(std::uint64_t n, double theta) : n(n), theta(theta)
+{
+    zetan = 0;
+    for (std::uint64_t k = 1; k <= n; k++)
+        zetan += 1.0 / std::pow(double(k), theta);
+    
+    double zeta2 = 1.0 + std::pow(0.5, theta);
+    alpha        = 1.0 / (1.0 - theta);
+    eta          = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+}
+
+// next Zipfian rank, rank 0 is the most popular
+// precondition: none
+// postcondition: return a rank in [0,n[
+std::uint64_t Zipf::operator()(std::mt19937_64& gen)
+{
+    double u  = std::uniform_real_distribution<double>(0.0, 1.0)(gen);
+    double uz = u * zetan;
+    
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + std::pow(0.5, theta))
+        return std::min<std::uint64_t>(1, n - 1);
+    
+    return std::min<std::uint64_t>(n - 1, static_cast<std::uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+}
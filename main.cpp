@@ -15,8 +15,11 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include <vector>
+#include <iostream>
+#include <cstdlib>
 #include "tests.h"
 
+// usage: main [seed]
 int main(int argc, const char * argv[])
 {
     // change these constants for different range and tree depth
@@ -24,12 +27,56 @@ int main(int argc, const char * argv[])
     constexpr int number_keys = 17;    // chosen out of the range
     std::vector<unsigned int> keys;
     
+    // the seed makes a failing run reproducible
+    unsigned int seed = (argc > 1) ? static_cast<unsigned int>(std::strtoul(argv[1], nullptr, 10)) : 1;
+    std::cout << "Random keys with seed " << seed << "\n\n";
+    
     // generate keys
-    generate_random_keys(max_range,number_keys,keys);
+    generate_random_keys(max_range,number_keys,keys,seed);
     
     (void)test_case_balanced_tree(keys);
     
     (void)test_case_unbalanced_tree(keys);
-
+    
+    (void)test_case_frozen_tree(keys);
+    
+    (void)test_case_eytzinger_index(keys);
+    
+    (void)test_case_bucket_tree(keys);
+    
+    (void)test_case_finger_tree(keys);
+    
+    (void)test_case_relaxed_tree(keys);
+    
+    (void)test_case_trace_recorder(keys);
+    
+    (void)test_case_multiset_tree(keys);
+    
+    (void)test_case_lazy_tree(keys);
+    
+    (void)test_case_wavl_tree(keys);
+    
+    (void)test_case_interval_tree(keys);
+    
+    (void)test_case_hash_index(keys);
+    
+    (void)test_case_static_tree(keys);
+    
+    (void)test_case_replicated_tree(keys);
+    
+    (void)test_case_relocation(keys);
+    
+    (void)test_case_durable_tree(keys);
+    
+    (void)test_case_buffered_tree(keys);
+    
+    (void)test_case_string_tree(keys);
+    
+    (void)test_case_tree_export(keys);
+    
+    (void)test_case_hot_cache(keys);
+    
+    (void)test_case_memory_limit(keys);
+    
     return 0;
 }
@@ -0,0 +1,302 @@
+/*
+    AVLTree C++ class
+    Copyright (C) 2021 Michele Iarossi - michele@mathsophy.com
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation version 3 of the License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <set>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "AVLTree.h"
+#include "BucketAVLTree.h"
+#include "ReplicatedAVLTree.h"
+#include "BufferedAVLTree.h"
+
+using mathsophy::AVLTree;
+using mathsophy::AVLBalance;
+using mathsophy::AVLFeatures;
+using mathsophy::node_marks;
+using mathsophy::BucketAVLTree;
+using mathsophy::ReplicatedAVLTree;
+using mathsophy::BufferedAVLTree;
+using mathsophy::AVLTraceRecord;
+using mathsophy::AVLTraceOperation;
+using mathsophy::read_trace;
+using mathsophy::trace_insert;
+using mathsophy::trace_remove;
+using mathsophy::trace_find;
+
+// private types --------------------------
+
+// AVLTree in one of its modes
+template<class T>
+class TreeStructure
+{
+public:
+    TreeStructure(const std::string& config)
+    {
+        unbalanced = (config == "unbalanced");
+        relaxed    = (config == "relaxed");
+        tree.set_finger_mode(config == "finger");
+        tree.set_relaxed_mode(relaxed);
+    };
+    void        insert(T key) { if (unbalanced) tree.unbalanced_insert(key); else tree.insert(key); };
+    bool        find(T key) { return tree.find(key) != nullptr; };
+    void        remove(T key) { if (unbalanced) tree.unbalanced_remove(key); else tree.remove(key); };
+    // bounded share of the deferred rebalancing after a batch of updates
+    void        maintain() { if (relaxed) (void)tree.rebalance_pending(maintenance_interval); };
+    static constexpr std::size_t maintenance_interval = 256;
+    static constexpr bool        synchronized = false;
+private:
+    AVLTree<T, AVLFeatures<AVLBalance, node_marks>> tree;
+    bool       unbalanced;
+    bool       relaxed;
+};
+
+// tree of sorted buckets
+template<class T>
+class BucketStructure
+{
+public:
+    BucketStructure(const std::string&) { };
+    void        insert(T key) { tree.insert(key); };
+    bool        find(T key) { return tree.find(key) != nullptr; };
+    void        remove(T key) { tree.remove(key); };
+    void        maintain() { };
+    static constexpr std::size_t maintenance_interval = SIZE_MAX;
+    static constexpr bool        synchronized = false;
+private:
+    BucketAVLTree<T> tree;
+};
+
+// thread-safe tree with one replica per NUMA node
+template<class T>
+class ReplicatedStructure
+{
+public:
+    ReplicatedStructure(const std::string&) { };
+    void        insert(T key) { tree.insert(key); };
+    bool        find(T key) { return tree.find(key); };
+    void        remove(T key) { tree.remove(key); };
+    void        maintain() { };
+    static constexpr std::size_t maintenance_interval = SIZE_MAX;
+    static constexpr bool        synchronized = true;
+private:
+    ReplicatedAVLTree<T> tree;
+};
+
+// thread-safe tree with per-thread write buffers
+template<class T>
+class BufferedStructure
+{
+public:
+    BufferedStructure(const std::string&) { };
+    void        insert(T key) { tree.insert(key); };
+    bool        find(T key) { return tree.find(key); };
+    void        remove(T key) { tree.remove(key); };
+    void        maintain() { };
+    static constexpr std::size_t maintenance_interval = SIZE_MAX;
+    static constexpr bool        synchronized = true;
+private:
+    BufferedAVLTree<T> tree;
+};
+
+// std::set baseline
+template<class T>
+class SetStructure
+{
+public:
+    SetStructure(const std::string&) { };
+    void        insert(T key) { (void)keys.insert(key); };
+    bool        find(T key) { return keys.find(key) != keys.end(); };
+    void        remove(T key) { (void)keys.erase(key); };
+    void        maintain() { };
+    static constexpr std::size_t maintenance_interval = SIZE_MAX;
+    static constexpr bool        synchronized = false;
+private:
+    std::set<T> keys;
+};
+
+// private functions ----------------------
+
+// replay a trace with the given key type on the configured structure
+template <class T>
+static int replay_trace(const std::string& file_name, const std::string& config, unsigned int threads, unsigned int repeat);
+
+// replay the trace on one structure and report the throughput
+template <class S, class T>
+static void replay(const std::vector<AVLTraceRecord<T>>& trace, const std::string& config,
+                   unsigned int threads, unsigned int repeat);
+
+// main -----------------------------------
+
+// usage: replay trace [--config avl|finger|relaxed|unbalanced|bucket|replicated|buffered|set]
+//                     [--threads n] [--repeat n] [--key-size 4|8]
+int main(int argc, const char * argv[])
+{
+    std::string file_name;
+    std::string config     = "avl";
+    unsigned int threads   = 1;
+    unsigned int repeat    = 1;
+    unsigned int key_size  = 4;
+    
+    for (int k = 1; k < argc; k++)
+    {
+        if (std::strcmp(argv[k], "--config") == 0 && k + 1 < argc)
+            config = argv[++k];
+        else if (std::strcmp(argv[k], "--threads") == 0 && k + 1 < argc)
+            threads = static_cast<unsigned int>(std::strtoul(argv[++k], nullptr, 10));
+        else if (std::strcmp(argv[k], "--repeat") == 0 && k + 1 < argc)
+            repeat = static_cast<unsigned int>(std::strtoul(argv[++k], nullptr, 10));
+        else if (std::strcmp(argv[k], "--key-size") == 0 && k + 1 < argc)
+            key_size = static_cast<unsigned int>(std::strtoul(argv[++k], nullptr, 10));
+        else
+            file_name = argv[k];
+    }
+    
+    if (file_name.empty() || threads == 0 || repeat == 0)
+    {
+        std::cerr << "usage: replay trace [--config avl|finger|relaxed|unbalanced|bucket|replicated|buffered|set]"
+                     " [--threads n] [--repeat n] [--key-size 4|8]\n";
+        return 1;
+    }
+    
+    if (key_size == 8)
+        return replay_trace<std::uint64_t>(file_name, config, threads, repeat);
+    
+    return replay_trace<std::uint32_t>(file_name, config, threads, repeat);
+}
+
+// private functions implementation
+
+// load the trace and dispatch on the structure configuration
+// precondition: none
+// postcondition: return 0 on success, 1 if the trace or the configuration
+// is not valid
+template <class T>
+int replay_trace(const std::string& file_name, const std::string& config, unsigned int threads, unsigned int repeat)
+{
+    std::vector<AVLTraceRecord<T>> trace;
+    
+    if ( !read_trace(file_name, trace) )
+    {
+        std::cerr << "-> cannot read trace " << file_name << " with " << sizeof(T) << " byte keys\n";
+        return 1;
+    }
+    
+    if (config == "avl" || config == "finger" || config == "relaxed" || config == "unbalanced")
+        replay<TreeStructure<T>>(trace, config, threads, repeat);
+    else if (config == "bucket")
+        replay<BucketStructure<T>>(trace, config, threads, repeat);
+    else if (config == "replicated")
+        replay<ReplicatedStructure<T>>(trace, config, threads, repeat);
+    else if (config == "buffered")
+        replay<BufferedStructure<T>>(trace, config, threads, repeat);
+    else if (config == "set")
+        replay<SetStructure<T>>(trace, config, threads, repeat);
+    else
+    {
+        std::cerr << "-> unknown configuration " << config << "\n";
+        return 1;
+    }
+    
+    return 0;
+}
+
+// replay the trace on a new structure for each repetition. With more than
+// one thread the trace is cut into contiguous slices, one per thread, and the
+// threads share the structure through a reader-writer lock: lookups run
+// concurrently, insertions and removals exclusively. The synchronized
+// structures are shared without the lock.
+// precondition: none
+// postcondition: throughput printed on standard output
+template <class S, class T>
+void replay(const std::vector<AVLTraceRecord<T>>& trace, const std::string& config,
+            unsigned int threads, unsigned int repeat)
+{
+    using Clock = std::chrono::steady_clock;
+    std::uint64_t found = 0;
+    double seconds      = 0;
+    
+    for (unsigned int round = 0; round < repeat; round++)
+    {
+        S structure(config);
+        std::shared_mutex lock;
+        std::vector<std::uint64_t> hits(threads, 0);
+        
+        auto worker = [&](unsigned int thread)
+        {
+            std::size_t first = trace.size() * thread / threads;
+            std::size_t last  = trace.size() * (thread + 1) / threads;
+            std::uint64_t hit    = 0;
+            std::uint64_t writes = 0;
+            
+            for (std::size_t k = first; k < last; k++)
+            {
+                const AVLTraceRecord<T>& record = trace[k];
+                if (record.operation == trace_find)
+                {
+                    std::shared_lock<std::shared_mutex> reader(lock, std::defer_lock);
+                    if (threads > 1 && !S::synchronized)
+                        reader.lock();
+                    hit += structure.find(record.key);
+                }
+                else
+                {
+                    std::unique_lock<std::shared_mutex> writer(lock, std::defer_lock);
+                    if (threads > 1 && !S::synchronized)
+                        writer.lock();
+                    if (record.operation == trace_insert)
+                        structure.insert(record.key);
+                    else if (record.operation == trace_remove)
+                        structure.remove(record.key);
+                    if (++writes % S::maintenance_interval == 0)
+                        structure.maintain();
+                }
+            }
+            
+            hits[thread] = hit;
+        };
+        
+        auto start = Clock::now();
+        std::vector<std::thread> pool;
+        for (unsigned int thread = 1; thread < threads; thread++)
+            pool.emplace_back(worker, thread);
+        worker(0);
+        for (std::thread& thread : pool)
+            thread.join();
+        auto stop  = Clock::now();
+        
+        seconds += std::chrono::duration<double>(stop - start).count();
+        for (std::uint64_t hit : hits)
+            found += hit;
+    }
+    
+    std::uint64_t operations = std::uint64_t(trace.size()) * repeat;
+    std::cout << "Replay of " << trace.size() << " operations on " << config
+              << ", " << threads << " thread(s), " << repeat << " repetition(s)\n";
+    std::cout << std::fixed << std::setprecision(2)
+              << "  " << operations / seconds / 1e6 << " Mops/s, "
+              << 1e9 * seconds / operations << " ns/op, "
+              << found << " successful finds\n";
+}
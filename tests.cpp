@@ -19,7 +19,22 @@
 #include <vector>
 #include <random>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <sstream>
+#include <limits>
 #include "AVLTree.h"
+#include "BucketAVLTree.h"
+#include "IntervalAVLTree.h"
+#include "StaticAVLTree.h"
+#include "ReplicatedAVLTree.h"
+#include "DurableAVLTree.h"
+#include "BufferedAVLTree.h"
+#include "StringAVLTree.h"
+#include "AVLTreeExport.h"
 #include <gvc.h>
 
 #include "tests.h"
@@ -33,6 +48,34 @@
 
 using mathsophy::AVLTree;
 using mathsophy::AVLNode;
+using mathsophy::AVLFeatureNode;
+using mathsophy::AVLBalance;
+using mathsophy::AVLFeatures;
+using mathsophy::node_sizes;
+using mathsophy::node_counts;
+using mathsophy::node_marks;
+using mathsophy::AVLFinger;
+using mathsophy::WAVLBalance;
+using mathsophy::FrozenAVLTree;
+using mathsophy::EytzingerIndex;
+using mathsophy::BucketAVLTree;
+using mathsophy::IntervalAVLTree;
+using mathsophy::StaticAVLTree;
+using mathsophy::ReplicatedAVLTree;
+using mathsophy::DurableAVLTree;
+using mathsophy::BufferedAVLTree;
+using mathsophy::StringAVLTree;
+using mathsophy::AVLExportOptions;
+using mathsophy::export_tree;
+using mathsophy::export_json;
+using mathsophy::evict_smallest;
+using mathsophy::evict_lru;
+using mathsophy::AVLTraceRecorder;
+using mathsophy::AVLTraceRecord;
+using mathsophy::read_trace;
+using mathsophy::trace_insert;
+using mathsophy::trace_remove;
+using mathsophy::trace_find;
 
 // private functions ----------------------
 
@@ -54,13 +97,13 @@ static int generate_tree_graph(AVLTree<unsigned int>& tree, std::string file_nam
 
 // public functions implementation
 
-// generate a vector of random keys between [0,range[
+// generate a vector of random keys between [0,range[, the same seed gives
+// the same keys
 // precondition: a positive range is provided
 // postcondition: return a vector of total_keys keys in the given range
-int generate_random_keys(int range, int total_keys, std::vector<unsigned int>& keys)
+int generate_random_keys(int range, int total_keys, std::vector<unsigned int>& keys, unsigned int seed)
 {
-    std::random_device  rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(seed);
     std::uniform_int_distribution<unsigned int>  distr(0, range);
     int k = 0;
     
@@ -84,7 +127,8 @@ int generate_random_keys(int range, int total_keys, std::vector<unsigned int>& k
 // test case for balanced trees. Balanced insertion and removal are tested.
 // After every insertion and removal the tree is checked for being balanced or
 // not. Inserted and removed keys are also tested whether they can be found or not
-// in the tree after insertion or deletion.
+// in the tree after insertion or deletion. The complete tree is validated and
+// batched lookups are checked against single lookups.
 // precondition: a valid vector of keys is given
 // postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
 // return TEST_FAILED as soon as an inconsistency is found
@@ -132,132 +176,1305 @@ int test_case_balanced_tree(std::vector<unsigned int>& keys)
     // comment this line if you do not want a graph to be generated
     generate_tree_graph(tree,"Test_balanced_tree_graph");
     
+    // test the structure of the complete tree, sequentially and in parallel
+    if ( !tree.validate() || !tree.validate(4) )
+    {
+        std::cerr << "-> failure of validation: inconsistent tree structure! \n";
+        
+        return TEST_FAILED;
+    }
+    
+    // test batched lookups against single lookups
+    {
+        std::vector<unsigned int> queries;
+        std::vector<AVLNode<unsigned int>*> nodes;
+        
+        for (unsigned int key : keys)
+        {
+            queries.push_back(key);
+            queries.push_back(key + 1);
+        }
+        
+        tree.find_batch(queries, nodes);
+        
+        for (std::size_t k = 0; k < queries.size(); k++)
+        {
+            if (nodes[k] != tree.find(queries[k]))
+            {
+                std::cerr << "-> failure of batched lookup: result differs from find! \n";
+                std::cerr << "\t key causing the failure = " << queries[k] << "\n";
+                
+                return TEST_FAILED;
+            }
+        }
+    }
+    
     // test balanced removal
     {
-        unsigned int n = 0;
-        int result     = 0;
-        
+        unsigned int n = 0;
+        int result     = 0;
+        
+        for (unsigned int key : keys)
+        {
+            result = delete_test(tree,key);
+            
+            if (result == E_AVLTREE_UNBALANCED)
+            {
+                std::cerr << "-> failure after deletion: tree unbalanced!\n";
+                std::cerr << "\t key causing the failure = " << key << "\n";
+                
+                generate_tree_graph(tree,"Unbalanced_removal_of_" + std::to_string(key));
+                
+                return result;
+            } else if (result == E_AVLTREE_KEY)
+            {
+                std::cerr << "-> failure after deletion: deleted key found! \n";
+                std::cerr << "\t key causing the failure = " << key << "\n";
+                
+                generate_tree_graph(tree,"Missing_removal_of_" + std::to_string(key));
+                
+                return result;
+            }
+            else
+            {
+                // comment this line if you do not want a graph to be generated after each removal
+                generate_tree_graph(tree,"Test_balanced_" +  std::to_string(++n) + "_remove_" + std::to_string(key));
+            }
+        }
+    }
+    
+    // check if the tree is empty
+    if ( tree.is_not_empty() )
+    {
+        std::cerr << " -> failure after deletion: tree not empty!\n";
+        generate_tree_graph(tree,"Tree_not_empty");
+        return TEST_FAILED;
+    }
+    else
+        std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// test case for unbalanced trees. Unbalanced insertion and removal are tested.
+// Inserted and removed keys are tested whether they can be found or not
+// in the tree after insertion or deletion. A copy of the unbalanced tree is
+// rebuilt and checked for being balanced.
+// precondition: a valid vector of keys is given
+// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
+// return TEST_FAILED as soon as an inconsistency is found
+int test_case_unbalanced_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> unbalanced_tree;
+    
+    // start of the test
+    std::cout << "Test of unbalanced insertion and removal\n";
+    
+    // test unbalanced insertion
+    {
+        unsigned int n = 0;
+        int result     = 0;
+        
+        for (unsigned int key : keys)
+        {
+            result = unbalanced_insert_test(unbalanced_tree,key);
+            
+            if (result == E_AVLTREE_KEY)
+            {
+                std::cerr << "-> failure after insertion: inserted key not found! \n";
+                std::cerr << "\t key causing the failure = " << key << "\n";
+                
+                // generate_tree_graph(tree,"Missing_insert_of_" + std::to_string(key));
+                
+                return result;
+            }
+            else
+            {
+                // comment this line if you do not want a graph to be generated after each insertion
+                generate_tree_graph(unbalanced_tree,"Test_unbalanced_" +  std::to_string(++n) + "_add_" + std::to_string(key));
+            }
+        }
+    }
+    
+    // comment this line if you do not want a graph to be generated
+    generate_tree_graph(unbalanced_tree,"Test_unbalanced_tree_graph");
+    
+    // test global rebuild of a copy of the unbalanced tree
+    {
+        AVLTree<unsigned int> rebuilt_tree(unbalanced_tree);
+        
+        rebuilt_tree.rebalance_all();
+        
+        if ( rebuilt_tree.is_not_balanced() )
+        {
+            std::cerr << "-> failure after rebuild: tree unbalanced! \n";
+            
+            return E_AVLTREE_UNBALANCED;
+        }
+        
+        for (unsigned int key : keys)
+            if ( rebuilt_tree.find(key) == nullptr )
+            {
+                std::cerr << "-> failure after rebuild: key not found! \n";
+                std::cerr << "\t key causing the failure = " << key << "\n";
+                
+                return E_AVLTREE_KEY;
+            }
+    }
+    
+    // test unbalanced removal
+    {
+        unsigned int n = 0;
+        int result     = 0;
+        
+        for (unsigned int key : keys)
+        {
+            result = unbalanced_delete_test(unbalanced_tree,key);
+            
+            if (result == E_AVLTREE_KEY)
+            {
+                std::cerr << "-> failure after deletion: deleted key found! \n";
+                std::cerr << "\t key causing the failure = " << key << "\n";
+                
+                //generate_tree_graph(tree,"Missing_removal_of_" + std::to_string(key));
+                
+                return result;
+            }
+            else
+            {
+                // comment this line if you do not want a graph to be generated after each removal
+                generate_tree_graph(unbalanced_tree,"Test_unbalanced_" +  std::to_string(++n) + "_remove_" + std::to_string(key));
+            }
+        }
+    }
+    
+    // check if the tree is empty
+    if ( unbalanced_tree.is_not_empty() )
+    {
+        std::cerr << " -> failure after deletion: unbalanced tree not empty!\n";
+        // generate_tree_graph(tree,"Unbalanced_tree_not_empty");
+        return TEST_FAILED;
+    }
+    else
+        std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// test case for frozen trees. The van Emde Boas snapshot of a balanced tree is
+// tested for containing exactly the keys of the tree, both by single lookups and
+// by range queries.
+// precondition: a valid vector of keys is given
+// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
+// return TEST_FAILED as soon as an inconsistency is found
+int test_case_frozen_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of frozen tree lookups and range queries\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    FrozenAVLTree<unsigned int> frozen = tree.freeze();
+    
+    // test lookups of present and missing keys
+    for (unsigned int key : keys)
+    {
+        const unsigned int* found = frozen.find(key);
+        
+        if ( found == nullptr || *found != key )
+        {
+            std::cerr << "-> failure after freezing: key not found! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+        
+        if ( (tree.find(key + 1) == nullptr) != (frozen.find(key + 1) == nullptr) )
+        {
+            std::cerr << "-> failure after freezing: lookup mismatch! \n";
+            std::cerr << "\t key causing the failure = " << key + 1 << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    // test range queries on the whole tree and on a sub-range
+    std::vector<unsigned int> sorted_keys(keys);
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    
+    std::vector<unsigned int> range;
+    frozen.find_range(sorted_keys.front(), sorted_keys.back(), range);
+    if ( range != sorted_keys )
+    {
+        std::cerr << "-> failure of range query: wrong keys returned! \n";
+        return TEST_FAILED;
+    }
+    
+    range.clear();
+    frozen.find_range(sorted_keys.front() + 1, sorted_keys.back() - 1, range);
+    if ( range != std::vector<unsigned int>(sorted_keys.begin() + 1, sorted_keys.end() - 1) )
+    {
+        std::cerr << "-> failure of sub-range query: wrong keys returned! \n";
+        return TEST_FAILED;
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// test case for Eytzinger indexes. The exported index is tested for finding
+// exactly the keys of the tree, both by single and by batched lookups.
+// precondition: a valid vector of keys is given
+// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
+// return TEST_FAILED as soon as an inconsistency is found
+int test_case_eytzinger_index(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of Eytzinger index lookups\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // the largest value pads the index, it is looked up before and after
+    // being inserted into the tree
+    const unsigned int largest = std::numeric_limits<unsigned int>::max();
+    for (int round = 0; round < 2; round++)
+    {
+        if (round == 1)
+            tree.insert(largest);
+        
+        EytzingerIndex<unsigned int> index = tree.export_eytzinger();
+        
+        // look up the keys and their successors, which might be missing
+        std::vector<unsigned int> queries(1, largest);
+        for (unsigned int key : keys)
+        {
+            queries.push_back(key);
+            queries.push_back(key + 1);
+        }
+        
+        std::vector<const unsigned int*> found;
+        index.find_batch(queries, found);
+        
+        for (std::size_t k = 0; k < queries.size(); k++)
+        {
+            bool in_tree = tree.find(queries[k]) != nullptr;
+            
+            if ( in_tree != (index.find(queries[k]) != nullptr) || in_tree != (found[k] != nullptr) )
+            {
+                std::cerr << "-> failure of Eytzinger lookup: result differs from the tree! \n";
+                std::cerr << "\t key causing the failure = " << queries[k] << "\n";
+                return TEST_FAILED;
+            }
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// test case for bucket trees. Small buckets are used so that insertions split
+// and removals merge buckets. After every insertion and removal the tree is
+// checked for being balanced and for finding the key or not.
+// precondition: a valid vector of keys is given
+// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
+// return TEST_FAILED as soon as an inconsistency is found
+int test_case_bucket_tree(std::vector<unsigned int>& keys)
+{
+    BucketAVLTree<unsigned int, 8> tree;
+    
+    // start of the test
+    std::cout << "Test of bucket tree insertion and removal\n";
+    
+    for (unsigned int key : keys)
+    {
+        tree.insert(key);
+        
+        if ( tree.is_not_balanced() || tree.find(key) == nullptr )
+        {
+            std::cerr << "-> failure after bucket insertion: tree unbalanced or key not found! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    for (unsigned int key : keys)
+    {
+        tree.remove(key);
+        
+        if ( tree.is_not_balanced() || tree.find(key) != nullptr )
+        {
+            std::cerr << "-> failure after bucket removal: tree unbalanced or key found! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    // non-integral keys take the scalar search of the buckets
+    BucketAVLTree<std::string, 4> names;
+    for (unsigned int key : keys)
+        names.insert(std::to_string(key));
+    for (unsigned int key : keys)
+        if ( names.find(std::to_string(key)) == nullptr || names.find(std::to_string(key) + "x") != nullptr )
+        {
+            std::cerr << "-> failure of the string bucket tree: wrong lookup! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    for (unsigned int key : keys)
+        names.remove(std::to_string(key));
+    
+    // check if the tree is empty
+    if ( tree.is_not_empty() || tree.size() != 0 )
+    {
+        std::cerr << " -> failure after bucket removal: tree not empty!\n";
+        return TEST_FAILED;
+    }
+    else
+        std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// test case for finger insertions. The keys are inserted in finger mode first
+// in ascending order, then in the given order through an explicit hint into
+// a second tree. After every insertion the tree is checked for being balanced
+// and for finding the inserted key.
+// precondition: a valid vector of keys is given
+// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
+// return TEST_FAILED as soon as an inconsistency is found
+int test_case_finger_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree, hinted_tree;
+    AVLFinger<unsigned int> hint;
+    std::vector<unsigned int> sorted_keys(keys);
+    
+    // start of the test
+    std::cout << "Test of finger and hinted insertion\n";
+    
+    std::sort(sorted_keys.begin(), sorted_keys.end());
+    tree.set_finger_mode(true);
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+    {
+        tree.insert(sorted_keys[k]);
+        hinted_tree.insert(hint, keys[k]);
+        
+        if ( tree.is_not_balanced() || tree.find(sorted_keys[k]) == nullptr )
+        {
+            std::cerr << "-> failure after finger insertion: tree unbalanced or key not found! \n";
+            std::cerr << "\t key causing the failure = " << sorted_keys[k] << "\n";
+            return TEST_FAILED;
+        }
+        
+        if ( hinted_tree.is_not_balanced() || hint.get_node() != hinted_tree.find(keys[k]) )
+        {
+            std::cerr << "-> failure after hinted insertion: tree unbalanced or hint not on the key! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// relaxed tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the tree is not balanced after the
+// pending rebalancing, otherwise TEST_PASSED
+int test_case_relaxed_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int, AVLFeatures<AVLBalance, node_marks>> tree;
+    
+    // start of the test
+    std::cout << "Test of relaxed insertion and deferred rebalancing\n";
+    
+    tree.set_relaxed_mode(true);
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+    {
+        tree.insert(keys[k]);
+        
+        // a small rebalancing step every few insertions
+        if (k % 8 == 0)
+            (void)tree.rebalance_pending(4);
+    }
+    
+    // the marked nodes may be unbalanced, the structure must be consistent
+    if ( !tree.validate() )
+    {
+        std::cerr << "-> failure of validation: inconsistent relaxed tree! \n";
+        return TEST_FAILED;
+    }
+    
+    while ( !tree.rebalance_pending(16) )
+        ;
+    
+    if ( tree.is_not_balanced() || tree.is_rebalance_pending() )
+    {
+        std::cerr << "-> failure after deferred rebalancing: tree unbalanced! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+        if ( tree.find(keys[k]) == nullptr )
+        {
+            std::cerr << "-> failure after deferred rebalancing: key not found! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// trace recording test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the trace read back differs from the
+// operations performed, otherwise TEST_PASSED
+int test_case_trace_recorder(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    AVLTraceRecorder<unsigned int> recorder;
+    std::vector<AVLTraceRecord<unsigned int>> trace;
+    
+    // start of the test
+    std::cout << "Test of trace recording\n";
+    
+    if ( !recorder.open("Test_trace.bin") )
+    {
+        std::cerr << "-> failure of trace recording: file cannot be created! \n";
+        return TEST_FAILED;
+    }
+    
+    tree.set_recorder(&recorder);
+    for (unsigned int key : keys)
+    {
+        tree.insert(key);
+        (void)tree.find(key);
+    }
+    for (unsigned int key : keys)
+        tree.remove(key);
+    tree.set_recorder(nullptr);
+    
+    if ( !recorder.close() || !read_trace("Test_trace.bin", trace) || trace.size() != 3 * keys.size() )
+    {
+        std::cerr << "-> failure of trace reading: wrong number of operations! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+        if ( trace[2 * k].operation != trace_insert || trace[2 * k].key != keys[k] ||
+             trace[2 * k + 1].operation != trace_find || trace[2 * k + 1].key != keys[k] ||
+             trace[2 * keys.size() + k].operation != trace_remove || trace[2 * keys.size() + k].key != keys[k] )
+        {
+            std::cerr << "-> failure of trace reading: operation differs from the recorded one! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    
+    // a full disk is reported by close
+    AVLTraceRecorder<unsigned int> full;
+    if ( full.open("/dev/full") )
+    {
+        for (unsigned int key : keys)
+            full.record(trace_insert, key);
+        if ( full.close() )
+        {
+            std::cerr << "-> failure of trace recording: lost records not reported! \n";
+            return TEST_FAILED;
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// multiset tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a multiplicity, rank or selected
+// element differs from the expected one, otherwise TEST_PASSED
+int test_case_multiset_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int, AVLFeatures<AVLBalance, node_sizes | node_counts>> tree;
+    std::vector<unsigned int> sorted(keys);
+    
+    // start of the test
+    std::cout << "Test of multiset mode with order statistics\n";
+    
+    tree.set_multiset_mode(true);
+    
+    // every key inserted twice, then once removed
+    for (unsigned int key : keys)
+        tree.insert(key);
+    for (unsigned int key : keys)
+        tree.insert(key);
+    for (unsigned int key : keys)
+        tree.remove(key);
+    
+    if ( !tree.validate() || tree.size() != keys.size() )
+    {
+        std::cerr << "-> failure of multiset mode: wrong number of elements! \n";
+        return TEST_FAILED;
+    }
+    
+    std::sort(sorted.begin(), sorted.end());
+    for (std::size_t k = 0; k < sorted.size(); k++)
+    {
+        std::size_t first = std::lower_bound(sorted.begin(), sorted.end(), sorted[k]) - sorted.begin();
+        std::size_t last  = std::upper_bound(sorted.begin(), sorted.end(), sorted[k]) - sorted.begin();
+        AVLNode<unsigned int>* node = tree.select(k);
+        if ( !node || node->get_key() != sorted[k] || tree.rank(sorted[k]) != first ||
+             tree.count(sorted[k]) != last - first )
+        {
+            std::cerr << "-> failure of multiset mode: wrong order statistics! \n";
+            std::cerr << "\t key causing the failure = " << sorted[k] << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// lazy removal test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a removed key is still found or the
+// tree is inconsistent after the compaction, otherwise TEST_PASSED
+int test_case_lazy_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int, AVLFeatures<AVLBalance, node_sizes | node_counts>> tree;
+    
+    // start of the test
+    std::cout << "Test of lazy removal and compaction\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // remove the first half of the keys, compacting along the way
+    tree.set_lazy_mode(true);
+    for (std::size_t k = 0; k < keys.size() / 2; k++)
+    {
+        tree.remove(keys[k]);
+        
+        if ( tree.find(keys[k]) != nullptr )
+        {
+            std::cerr << "-> failure of lazy removal: key still found! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    tree.compact();
+    
+    if ( !tree.validate() || tree.is_not_balanced() || tree.get_tombstones() != 0 )
+    {
+        std::cerr << "-> failure after compaction: inconsistent tree! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = keys.size() / 2; k < keys.size(); k++)
+        if ( tree.find(keys[k]) == nullptr )
+        {
+            std::cerr << "-> failure after compaction: key not found! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// weak AVL tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the rank rules are violated or a key
+// is not found after the removals, otherwise TEST_PASSED
+int test_case_wavl_tree(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int, WAVLBalance> tree;
+    
+    // start of the test
+    std::cout << "Test of weak AVL balancing\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // remove every other key
+    for (std::size_t k = 0; k < keys.size(); k += 2)
+    {
+        tree.remove(keys[k]);
+        
+        if ( tree.find(keys[k]) != nullptr )
+        {
+            std::cerr << "-> failure of weak AVL removal: key still found! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    if ( !tree.validate() || tree.is_not_balanced() )
+    {
+        std::cerr << "-> failure of weak AVL removal: rank rules violated! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = 1; k < keys.size(); k += 2)
+        if ( tree.find(keys[k]) == nullptr )
+        {
+            std::cerr << "-> failure of weak AVL removal: key not found! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// interval tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if an overlap query differs from a
+// linear scan of the intervals, otherwise TEST_PASSED
+int test_case_interval_tree(std::vector<unsigned int>& keys)
+{
+    IntervalAVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of interval overlap queries\n";
+    
+    // intervals starting at the keys, of varying length
+    for (unsigned int key : keys)
+        tree.insert(key, key + key % 1000);
+    
+    if ( !tree.validate() )
+    {
+        std::cerr << "-> failure of interval insertion: inconsistent tree! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = 0; k < keys.size(); k += keys.size() / 100 + 1)
+    {
+        unsigned int low     = keys[k] / 2;
+        unsigned int high    = low + 500;
+        std::size_t found    = 0;
+        std::size_t expected = 0;
+        
+        tree.find_overlapping(low, high, [&found](unsigned int, unsigned int) { found++; });
+        // the keys are distinct, so are the intervals
+        for (unsigned int key : keys)
+            if (key <= high && low <= key + key % 1000)
+                expected++;
+        
+        if ( found != expected || tree.any_overlap(low, high) != (expected > 0) )
+        {
+            std::cerr << "-> failure of overlap query: wrong number of intervals! \n";
+            std::cerr << "\t query causing the failure = [" << low << "," << high << "]\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// hash index test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a lookup through the index differs
+// from the tree, otherwise TEST_PASSED
+int test_case_hash_index(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of the hash index\n";
+    
+    // load factors leaving no empty slot or growing forever are rejected
+    if ( tree.set_hash_mode(true, 0.0) || tree.set_hash_mode(true, 1.0) || tree.get_hash_mode() )
+    {
+        std::cerr << "-> failure of the hash index: invalid load factor accepted! \n";
+        return TEST_FAILED;
+    }
+    
+    tree.set_hash_mode(true);
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // remove every other key
+    for (std::size_t k = 0; k < keys.size(); k += 2)
+        tree.remove(keys[k]);
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+    {
+        AVLNode<unsigned int>* node = tree.find(keys[k]);
+        
+        if ( (k % 2 == 0) != (node == nullptr) || (node && node->get_key() != keys[k]) )
+        {
+            std::cerr << "-> failure of hashed lookup: wrong node! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    if ( !tree.validate() || tree.is_not_balanced() )
+    {
+        std::cerr << "-> failure of hashed removal: inconsistent tree! \n";
+        return TEST_FAILED;
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// table of the squares below 2^16, built at compile time
+static constexpr unsigned int square_keys[] =
+{
+    0, 1, 4, 9, 16, 25, 36, 49, 64, 81, 100, 121, 144, 169, 196, 225,
+    65025, 64516, 64009, 63504, 63001, 62500, 62001, 61504, 61009, 60516, 60025, 59536
+};
+static constexpr StaticAVLTree square_table(square_keys);
+static_assert(square_table.validate() && square_table.size() == 28, "static tree built at compile time");
+static_assert(square_table.contains(62500) && !square_table.contains(2), "static tree lookup at compile time");
+
+// compile-time tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a lookup in the static table differs
+// from the expected answer, otherwise TEST_PASSED
+int test_case_static_tree(std::vector<unsigned int>& keys)
+{
+    // start of the test
+    std::cout << "Test of the compile-time tree\n";
+    
+    for (unsigned int key : keys)
+    {
+        unsigned int root = 0;
+        while ((root + 1) * (root + 1) <= key)
+            root++;
+        bool expected = root * root == key && (root < 16 || root > 243);
+        
+        if ( square_table.contains(key) != expected )
+        {
+            std::cerr << "-> failure of static lookup: wrong answer! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// replicated tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the replicas differ after concurrent
+// updates or a reader misses a key, otherwise TEST_PASSED
+int test_case_replicated_tree(std::vector<unsigned int>& keys)
+{
+    ReplicatedAVLTree<unsigned int> tree(4, 64);
+    std::atomic<bool> missed(false);
+    
+    // start of the test
+    std::cout << "Test of the replicated tree\n";
+    
+    // one writer inserting the keys, readers looking up the inserted ones
+    std::thread writer([&tree, &keys]
+    {
         for (unsigned int key : keys)
+            tree.insert(key);
+    });
+    std::vector<std::thread> readers;
+    for (int k = 0; k < 3; k++)
+        readers.emplace_back([&tree, &keys, &missed]
         {
-            result = delete_test(tree,key);
-            
-            if (result == E_AVLTREE_UNBALANCED)
-            {
-                std::cerr << "-> failure after deletion: tree unbalanced!\n";
-                std::cerr << "\t key causing the failure = " << key << "\n";
-                
-                generate_tree_graph(tree,"Unbalanced_removal_of_" + std::to_string(key));
-                
-                return result;
-            } else if (result == E_AVLTREE_KEY)
-            {
-                std::cerr << "-> failure after deletion: deleted key found! \n";
-                std::cerr << "\t key causing the failure = " << key << "\n";
-                
-                generate_tree_graph(tree,"Missing_removal_of_" + std::to_string(key));
-                
-                return result;
-            }
-            else
-            {
-                // comment this line if you do not want a graph to be generated after each removal
-                generate_tree_graph(tree,"Test_balanced_" +  std::to_string(++n) + "_remove_" + std::to_string(key));
-            }
+            // an inserted key stays visible once found
+            for (unsigned int key : keys)
+                if (tree.find(key) && !tree.find(key))
+                    missed = true;
+        });
+    writer.join();
+    for (std::thread& reader : readers)
+        reader.join();
+    
+    if ( missed || !tree.validate() )
+    {
+        std::cerr << "-> failure of the replicas: inconsistent replicas! \n";
+        return TEST_FAILED;
+    }
+    
+    for (unsigned int key : keys)
+        if ( !tree.find(key) )
+        {
+            std::cerr << "-> failure of the replicas: key not found! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// node relocation test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a key is lost by the relocation or the
+// nodes are not contiguous in key order after it, otherwise TEST_PASSED
+int test_case_relocation(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of the compaction of the nodes\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // incremental compaction interleaved with removals
+    std::size_t k = 0;
+    while ( !tree.compact_incremental(std::chrono::nanoseconds(0)) && k < keys.size() )
+        tree.remove(keys[k++]);
+    while ( !tree.compact_incremental(std::chrono::microseconds(100)) )
+        continue;
+    
+    for (std::size_t n = 0; n < keys.size(); n++)
+        if ( (tree.find(keys[n]) == nullptr) != (n < k) )
+        {
+            std::cerr << "-> failure of incremental compaction: wrong key set! \n";
+            std::cerr << "\t key causing the failure = " << keys[n] << "\n";
+            return TEST_FAILED;
+        }
+    
+    tree.compact();
+    
+    // in-order neighbours are adjacent in memory, the nodes of a tree
+    // without features being plain AVLNodes
+    std::vector<const AVLNode<unsigned int>*> stack;
+    const AVLNode<unsigned int>* node     = tree.get_root();
+    const AVLNode<unsigned int>* previous = nullptr;
+    while (node || !stack.empty())
+    {
+        while (node)
+        {
+            stack.push_back(node);
+            node = node->get_left();
+        }
+        node = stack.back();
+        stack.pop_back();
+        if (previous && node != previous + 1)
+        {
+            std::cerr << "-> failure of compaction: nodes not contiguous! \n";
+            return TEST_FAILED;
         }
+        previous = node;
+        node     = node->get_right();
     }
     
-    // check if the tree is empty
-    if ( tree.is_not_empty() )
+    if ( !tree.validate() || tree.is_not_balanced() )
     {
-        std::cerr << " -> failure after deletion: tree not empty!\n";
-        generate_tree_graph(tree,"Tree_not_empty");
+        std::cerr << "-> failure of compaction: inconsistent tree! \n";
         return TEST_FAILED;
     }
-    else
-        std::cout << " -> passed\n";
+    
+    std::cout << " -> passed\n";
     
     std::cout << std::endl;
     
     return TEST_PASSED;
 }
 
-// test case for unbalanced trees. Unbalanced insertion and removal are tested.
-// Inserted and removed keys are tested whether they can be found or not
-// in the tree after insertion or deletion.
-// precondition: a valid vector of keys is given
-// postcondition: return TEST_PASSED if no inconsistency occurs, otherwise
-// return TEST_FAILED as soon as an inconsistency is found
-int test_case_unbalanced_tree(std::vector<unsigned int>& keys)
+// durable tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the recovered tree differs from the
+// tree before closing, otherwise TEST_PASSED
+int test_case_durable_tree(std::vector<unsigned int>& keys)
 {
-    AVLTree<unsigned int> unbalanced_tree;
+    (void)std::remove("Test_durable.ckpt");
+    (void)std::remove("Test_durable.wal");
     
     // start of the test
-    std::cout << "Test of unbalanced insertion and removal\n";
+    std::cout << "Test of the durable tree\n";
     
-    // test unbalanced insertion
     {
-        unsigned int n = 0;
-        int result     = 0;
+        DurableAVLTree<unsigned int> tree;
+        if ( !tree.open("Test_durable") )
+        {
+            std::cerr << "-> failure of the durable tree: cannot create the files! \n";
+            return TEST_FAILED;
+        }
         
-        for (unsigned int key : keys)
+        // insert the keys, checkpoint halfway, then remove every other key
+        for (std::size_t k = 0; k < keys.size(); k++)
         {
-            result = unbalanced_insert_test(unbalanced_tree,key);
-            
-            if (result == E_AVLTREE_KEY)
+            tree.insert(keys[k]);
+            if (k == keys.size() / 2)
+                tree.checkpoint();
+        }
+        for (std::size_t k = 0; k < keys.size(); k += 2)
+            tree.remove(keys[k]);
+    }
+    
+    // recovery from the snapshot and the log
+    DurableAVLTree<unsigned int> tree;
+    if ( !tree.open("Test_durable") )
+    {
+        std::cerr << "-> failure of the durable tree: recovery failed! \n";
+        return TEST_FAILED;
+    }
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+        if ( tree.find(keys[k]) != (k % 2 == 1) )
+        {
+            std::cerr << "-> failure of the durable tree: wrong key after recovery! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
+        }
+    
+    tree.close();
+    
+    // a corrupted key and an impossible key count are both rejected, the
+    // second flip of each byte restores the snapshot
+    long offsets[] = { 32, 32, 24, 24 };
+    for (int k = 0; k < 4; k++)
+    {
+        long offset = offsets[k];
+        std::FILE* file = std::fopen("Test_durable.ckpt", "r+b");
+        unsigned char byte = 0;
+        bool written = file && std::fseek(file, offset, SEEK_SET) == 0 && std::fread(&byte, 1, 1, file) == 1;
+        byte ^= 0x80;
+        written = written && std::fseek(file, offset, SEEK_SET) == 0 && std::fwrite(&byte, 1, 1, file) == 1;
+        if (file)
+            std::fclose(file);
+        
+        if ( !written || tree.open("Test_durable") != (k % 2 == 1) )
+        {
+            std::cerr << "-> failure of the durable tree: corrupted snapshot accepted! \n";
+            return TEST_FAILED;
+        }
+        tree.close();
+    }
+    
+    (void)std::remove("Test_durable.ckpt");
+    (void)std::remove("Test_durable.wal");
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// buffered tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a thread does not read its own
+// buffered writes or a key is lost by the merges, otherwise TEST_PASSED
+int test_case_buffered_tree(std::vector<unsigned int>& keys)
+{
+    BufferedAVLTree<unsigned int> tree(4);
+    std::atomic<bool> missed(false);
+    
+    // start of the test
+    std::cout << "Test of the buffered tree\n";
+    
+    // each thread writes the keys shifted to its own range and reads them back
+    std::vector<std::thread> writers;
+    for (unsigned int thread = 0; thread < 4; thread++)
+        writers.emplace_back([&tree, &keys, &missed, thread]
+        {
+            for (unsigned int key : keys)
             {
-                std::cerr << "-> failure after insertion: inserted key not found! \n";
-                std::cerr << "\t key causing the failure = " << key << "\n";
-                
-                // generate_tree_graph(tree,"Missing_insert_of_" + std::to_string(key));
-                
-                return result;
+                tree.insert(key + 1000 * thread);
+                if ( !tree.find(key + 1000 * thread) )
+                    missed = true;
             }
-            else
+        });
+    for (std::thread& writer : writers)
+        writer.join();
+    
+    if ( missed || !tree.validate() )
+    {
+        std::cerr << "-> failure of the buffered tree: own write not read! \n";
+        return TEST_FAILED;
+    }
+    
+    for (unsigned int thread = 0; thread < 4; thread++)
+        for (unsigned int key : keys)
+            if ( !tree.find(key + 1000 * thread) )
             {
-                // comment this line if you do not want a graph to be generated after each insertion
-                generate_tree_graph(unbalanced_tree,"Test_unbalanced_" +  std::to_string(++n) + "_add_" + std::to_string(key));
+                std::cerr << "-> failure of the buffered tree: key lost by a merge! \n";
+                std::cerr << "\t key causing the failure = " << key + 1000 * thread << "\n";
+                return TEST_FAILED;
             }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// string tree test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a path is not found or found after its
+// removal, or if the tree is inconsistent, otherwise TEST_PASSED
+int test_case_string_tree(std::vector<unsigned int>& keys)
+{
+    StringAVLTree tree;
+    
+    // start of the test
+    std::cout << "Test of the string tree\n";
+    
+    // distinct paths sharing long prefixes, some of them prefixes of others
+    auto path = [](unsigned int key)
+    {
+        std::string result = "/home/user/projects/avltree/" + std::to_string(key);
+        if (key % 3)
+            result += "/src/file.cpp";
+        return result;
+    };
+    
+    for (unsigned int key : keys)
+        tree.insert(path(key));
+    
+    for (unsigned int key : keys)
+        if ( !tree.find(path(key)) || tree.find(path(key) + "/") )
+        {
+            std::cerr << "-> failure of the string tree: wrong lookup! \n";
+            std::cerr << "\t key causing the failure = " << path(key) << "\n";
+            return TEST_FAILED;
         }
+    
+    for (unsigned int key : keys)
+        if (key % 2)
+            tree.remove(path(key));
+    
+    for (unsigned int key : keys)
+        if ( tree.find(path(key)) != (key % 2 == 0) || !tree.validate() || tree.is_not_balanced() )
+        {
+            std::cerr << "-> failure of the string tree: wrong removal! \n";
+            std::cerr << "\t key causing the failure = " << path(key) << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// tree export test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the exports miss nodes or edges or
+// ignore the depth limit, otherwise TEST_PASSED
+int test_case_tree_export(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of the tree export\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    auto count = [](const std::string& text, const std::string& pattern)
+    {
+        std::size_t n = 0;
+        for (std::size_t k = text.find(pattern); k != std::string::npos; k = text.find(pattern, k + 1))
+            n++;
+        return n;
+    };
+    
+    std::ostringstream dot;
+    std::ostringstream json;
+    std::ostringstream top;
+    AVLExportOptions options;
+    bool written = export_tree(tree, dot, options);
+    options.format = export_json;
+    written = written && export_tree(tree, json, options);
+    options.max_depth = 1;
+    written = written && export_tree(tree, top, options);
+    
+    if ( !written || count(dot.str(), " -> ") != tree.size() - 1 || count(json.str(), "\"key\"") != tree.size() ||
+         count(top.str(), "\"key\"") > 3 )
+    {
+        std::cerr << "-> failure of the tree export: wrong number of nodes! \n";
+        return TEST_FAILED;
     }
     
-    // comment this line if you do not want a graph to be generated
-    generate_tree_graph(unbalanced_tree,"Test_unbalanced_tree_graph");
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
 
-    // test unbalanced removal
+// hot-key cache test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if a lookup through the cache differs
+// from the tree or a repeated lookup misses the cache, otherwise TEST_PASSED
+int test_case_hot_cache(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    
+    // start of the test
+    std::cout << "Test of the hot-key cache\n";
+    
+    tree.set_cache_mode(true, 2 * keys.size());
+    for (unsigned int key : keys)
+        tree.insert(key);
+    
+    // the first lookups fill the cache, the repeated ones hit it
+    for (int round = 0; round < 2; round++)
+        for (unsigned int key : keys)
+            (void)tree.find(key);
+    
+    if (tree.get_cache_hits() == 0)
     {
-        unsigned int n = 0;
-        int result     = 0;
+        std::cerr << "-> failure of the cache: no hit on repeated lookups! \n";
+        return TEST_FAILED;
+    }
+    
+    // remove every other key, the cached nodes become invalid
+    for (std::size_t k = 0; k < keys.size(); k += 2)
+        tree.remove(keys[k]);
+    
+    for (std::size_t k = 0; k < keys.size(); k++)
+    {
+        AVLNode<unsigned int>* node = tree.find(keys[k]);
         
-        for (unsigned int key : keys)
+        if ( (k % 2 == 0) != (node == nullptr) || (node && node->get_key() != keys[k]) )
         {
-            result = unbalanced_delete_test(unbalanced_tree,key);
-            
-            if (result == E_AVLTREE_KEY)
-            {
-                std::cerr << "-> failure after deletion: deleted key found! \n";
-                std::cerr << "\t key causing the failure = " << key << "\n";
-                
-                //generate_tree_graph(tree,"Missing_removal_of_" + std::to_string(key));
-                
-                return result;
-            }
-            else
-            {
-                // comment this line if you do not want a graph to be generated after each removal
-                generate_tree_graph(unbalanced_tree,"Test_unbalanced_" +  std::to_string(++n) + "_remove_" + std::to_string(key));
-            }
+            std::cerr << "-> failure of cached lookup: wrong node! \n";
+            std::cerr << "\t key causing the failure = " << keys[k] << "\n";
+            return TEST_FAILED;
         }
     }
     
-    // check if the tree is empty
-    if ( unbalanced_tree.is_not_empty() )
+    std::cout << " -> passed\n";
+    
+    std::cout << std::endl;
+    
+    return TEST_PASSED;
+}
+
+// memory accounting test case
+// precondition: a vector of keys is given
+// postcondition: return TEST_FAILED if the accounting does not come back to
+// the empty tree, if the limit is exceeded or if other keys than the
+// smallest ones are evicted, otherwise TEST_PASSED
+int test_case_memory_limit(std::vector<unsigned int>& keys)
+{
+    AVLTree<unsigned int> tree;
+    std::size_t empty = tree.memory_usage();
+    
+    // start of the test
+    std::cout << "Test of the memory limit\n";
+    
+    // the nodes of a policy without features have no optional field, and
+    // the LRU eviction needs the reference bits
+    if ( sizeof(AVLFeatureNode<unsigned int, 0>) != sizeof(AVLNode<unsigned int>) ||
+         tree.set_memory_limit(empty, evict_lru) )
     {
-        std::cerr << " -> failure after deletion: unbalanced tree not empty!\n";
-        // generate_tree_graph(tree,"Unbalanced_tree_not_empty");
+        std::cerr << "-> failure of the node features: optional fields not selected! \n";
         return TEST_FAILED;
     }
-    else
-        std::cout << " -> passed\n";
+    
+    for (unsigned int key : keys)
+        tree.insert(key);
+    std::size_t full = tree.memory_usage();
+    for (unsigned int key : keys)
+        tree.remove(key);
+    
+    if ( tree.memory_usage() != empty || tree.peak_memory_usage() != full )
+    {
+        std::cerr << "-> failure of the memory accounting: wrong usage! \n";
+        return TEST_FAILED;
+    }
+    
+    // room for about half of the keys, the smallest ones evicted, the
+    // evictions not being recorded as removals
+    AVLTree<unsigned int> bounded;
+    AVLTraceRecorder<unsigned int> recorder;
+    if ( !recorder.open("Test_trace.bin") )
+    {
+        std::cerr << "-> failure of trace recording: file cannot be created! \n";
+        return TEST_FAILED;
+    }
+    bounded.set_recorder(&recorder);
+    bounded.set_memory_limit((empty + full) / 2, evict_smallest);
+    for (unsigned int key : keys)
+        bounded.insert(key);
+    bounded.set_recorder(nullptr);
+    recorder.close();
+    
+    if ( bounded.memory_usage() > bounded.get_memory_limit() || bounded.get_evictions() == 0 ||
+         !bounded.validate() || bounded.is_not_balanced() )
+    {
+        std::cerr << "-> failure of the memory limit: limit exceeded! \n";
+        return TEST_FAILED;
+    }
+    
+    if (recorder.size() != keys.size())
+    {
+        std::cerr << "-> failure of the eviction: evictions recorded as removals! \n";
+        return TEST_FAILED;
+    }
+    
+    const AVLNode<unsigned int>* first = bounded.get_root();
+    while (first->get_left())
+        first = first->get_left();
+    unsigned int smallest = first->get_key();
+    for (unsigned int key : keys)
+        if ( key > smallest && !bounded.find(key) )
+        {
+            std::cerr << "-> failure of the eviction: wrong key evicted! \n";
+            std::cerr << "\t key causing the failure = " << key << "\n";
+            return TEST_FAILED;
+        }
+    
+    std::cout << " -> passed\n";
     
     std::cout << std::endl;
     
@@ -350,10 +1567,10 @@ int generate_tree_graph(AVLTree<unsigned int>& tree, std::string file_name)
     Agedge_t *left_edge, *right_edge;
     GVC_t *gvc;
     int k = 0; // label for invisible nodes
-
+    
     // set up a graphviz context
     gvc = gvContext();
-
+    
     // Create a simple digraph
     g = agopen((char*)"AVLTree", Agdirected, 0);
     
@@ -407,7 +1624,7 @@ int generate_tree_graph(AVLTree<unsigned int>& tree, std::string file_name)
             agsafeset(left_child, (char*)"shape", (char*)"point", "");
             agsafeset(left_child, (char*)"style", (char*)"invis", "");
             agsafeset(left_edge, (char*)"style", (char*)"invis", "");
-            
+        
         }
         // add rihtg node
         if (node->get_right())
@@ -446,13 +1663,13 @@ int generate_tree_graph(AVLTree<unsigned int>& tree, std::string file_name)
     
     // Write the graph to file
     gvRenderFilename (gvc, g, "png", (char *)(file_name+".png").c_str());
-
+    
     // Free layout data
     gvFreeLayout(gvc, g);
-
+    
     // Free graph structures
     agclose(g);
-
+    
     // lose output file, free context, and return number of errors
     return (gvFreeContext(gvc));
 }
@@ -20,7 +20,7 @@
 
 
 // generate a vector of random keys
-int generate_random_keys(int range, int total_keys, std::vector<unsigned int>& keys);
+int generate_random_keys(int range, int total_keys, std::vector<unsigned int>& keys, unsigned int seed);
 
 // example test case for balanced trees
 int test_case_balanced_tree(std::vector<unsigned int>& keys);
@@ -28,4 +28,64 @@ int test_case_balanced_tree(std::vector<unsigned int>& keys);
 // example test case for unbalanced trees
 int test_case_unbalanced_tree(std::vector<unsigned int>& keys);
 
+// example test case for frozen trees
+int test_case_frozen_tree(std::vector<unsigned int>& keys);
+
+// example test case for Eytzinger indexes
+int test_case_eytzinger_index(std::vector<unsigned int>& keys);
+
+// example test case for bucket trees
+int test_case_bucket_tree(std::vector<unsigned int>& keys);
+
+// example test case for finger insertions
+int test_case_finger_tree(std::vector<unsigned int>& keys);
+
+// example test case for relaxed trees
+int test_case_relaxed_tree(std::vector<unsigned int>& keys);
+
+// example test case for trace recording
+int test_case_trace_recorder(std::vector<unsigned int>& keys);
+
+// example test case for multiset trees
+int test_case_multiset_tree(std::vector<unsigned int>& keys);
+
+// example test case for lazy removal
+int test_case_lazy_tree(std::vector<unsigned int>& keys);
+
+// example test case for weak AVL trees
+int test_case_wavl_tree(std::vector<unsigned int>& keys);
+
+// example test case for interval trees
+int test_case_interval_tree(std::vector<unsigned int>& keys);
+
+// example test case for the hash index
+int test_case_hash_index(std::vector<unsigned int>& keys);
+
+// example test case for compile-time trees
+int test_case_static_tree(std::vector<unsigned int>& keys);
+
+// example test case for replicated trees
+int test_case_replicated_tree(std::vector<unsigned int>& keys);
+
+// example test case for the compaction of the nodes
+int test_case_relocation(std::vector<unsigned int>& keys);
+
+// example test case for durable trees
+int test_case_durable_tree(std::vector<unsigned int>& keys);
+
+// example test case for buffered trees
+int test_case_buffered_tree(std::vector<unsigned int>& keys);
+
+// example test case for string trees
+int test_case_string_tree(std::vector<unsigned int>& keys);
+
+// example test case for the tree export
+int test_case_tree_export(std::vector<unsigned int>& keys);
+
+// example test case for the hot-key cache
+int test_case_hot_cache(std::vector<unsigned int>& keys);
+
+// example test case for the memory limit
+int test_case_memory_limit(std::vector<unsigned int>& keys);
+
 #endif /* tests_h */